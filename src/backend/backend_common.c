@@ -67,7 +67,9 @@ xcb_image_t *make_shadow(xcb_connection_t *c, const conv *kernel,
 	 * height+r +-----+---------+-----+
 	 */
 	xcb_image_t *ximage;
-	const double *shadow_sum = kernel->rsum;
+	const uint32_t *shadow_sum = kernel->rsum;
+	// Turns the sums into 8-bit alpha values
+	const double scale = opacity * 255.0 / KERNEL_SUM_ONE;
 	int d = kernel->size, r = d / 2;
 	int swidth = width + r * 2, sheight = height + r * 2;
 
@@ -127,51 +129,98 @@ xcb_image_t *make_shadow(xcb_connection_t *c, const conv *kernel,
 				                                   d - y - 1, width, d) *
 				             255.0;
 				data[y * sstride + x] = sum;
-				data[(sheight - y - 1) * sstride + x] = sum;
 			}
+			memcpy(&data[(sheight - y - 1) * sstride], &data[y * sstride],
+			       swidth);
 		}
-		for (int x = 0; x < swidth; x++) {
-			double sum =
-			    sum_kernel_normalized(kernel, d - x - 1, 0, width, d) * 255.0;
-			for (int y = r * 2; y < height; y++) {
-				data[y * sstride + x] = sum;
+		if (height > r * 2) {
+			// The middle rows are all the same, build the first one and
+			// copy it down
+			unsigned char *row = &data[r * 2 * sstride];
+			for (int x = 0; x < swidth; x++) {
+				double sum =
+				    sum_kernel_normalized(kernel, d - x - 1, 0, width, d) *
+				    255.0;
+				row[x] = sum;
+			}
+			for (int y = r * 2 + 1; y < height; y++) {
+				memcpy(&data[y * sstride], row, swidth);
 			}
 		}
 		return ximage;
 	}
 
-	// Fill part 3
-	for (int y = r; y < height + r; y++) {
-		memset(data + sstride * y + r, 255, width);
-	}
+	// Rows are built once from the kernel sums and copied wherever they
+	// repeat, so every byte is written exactly once, a row at a time.
 
-	// Part 1
+	// Part 1 and 2, top rows, mirrored to the bottom
 	for (int y = 0; y < r * 2; y++) {
+		unsigned char *row = &data[y * sstride];
 		for (int x = 0; x < r * 2; x++) {
-			double tmpsum = shadow_sum[y * d + x] * opacity * 255.0;
-			data[y * sstride + x] = tmpsum;
-			data[(sheight - y - 1) * sstride + x] = tmpsum;
-			data[(sheight - y - 1) * sstride + (swidth - x - 1)] = tmpsum;
-			data[y * sstride + (swidth - x - 1)] = tmpsum;
+			unsigned char tmpsum = shadow_sum[y * d + x] * scale;
+			row[x] = tmpsum;
+			row[swidth - x - 1] = tmpsum;
 		}
+		unsigned char tmpsum = shadow_sum[d * y + d - 1] * scale;
+		memset(&row[r * 2], tmpsum, width - r * 2);
+		memcpy(&data[(sheight - y - 1) * sstride], row, swidth);
 	}
 
-	// Part 2, top/bottom
-	for (int y = 0; y < r * 2; y++) {
-		double tmpsum = shadow_sum[d * y + d - 1] * opacity * 255.0;
-		memset(&data[y * sstride + r * 2], tmpsum, width - r * 2);
-		memset(&data[(sheight - y - 1) * sstride + r * 2], tmpsum, width - r * 2);
+	// Part 2 left/right and part 3, the middle rows are all the same
+	if (height > r * 2) {
+		unsigned char *row = &data[r * 2 * sstride];
+		for (int x = 0; x < r * 2; x++) {
+			unsigned char tmpsum = shadow_sum[d * (d - 1) + x] * scale;
+			row[x] = tmpsum;
+			row[swidth - x - 1] = tmpsum;
+		}
+		memset(&row[r * 2], 255, width - r * 2);
+		for (int y = r * 2 + 1; y < height; y++) {
+			memcpy(&data[y * sstride], row, swidth);
+		}
 	}
 
-	// Part 2, left/right
-	for (int x = 0; x < r * 2; x++) {
-		double tmpsum = shadow_sum[d * (d - 1) + x] * opacity * 255.0;
-		for (int y = r * 2; y < height; y++) {
-			data[y * sstride + x] = tmpsum;
-			data[y * sstride + (swidth - x - 1)] = tmpsum;
-		}
+	return ximage;
+}
+
+xcb_image_t *make_shadow_argb(xcb_connection_t *c, const conv *kernel, double opacity,
+                              int width, int height, double red, double green,
+                              double blue) {
+	xcb_image_t *alpha_image = make_shadow(c, kernel, opacity, width, height);
+	if (!alpha_image)
+		return NULL;
+
+	xcb_image_t *ximage =
+	    xcb_image_create_native(c, alpha_image->width, alpha_image->height,
+	                            XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 0, 0, NULL);
+	if (!ximage) {
+		log_error("failed to create an X image");
+		xcb_image_destroy(alpha_image);
+		return NULL;
+	}
+	assert(ximage->bpp == 32);
+
+	// Premultiplied pixel for every alpha value, in the byte order of the
+	// image
+	const uint32_t one = 1;
+	const bool swap = (*(const uint8_t *)&one == 1) !=
+	                  (ximage->byte_order == XCB_IMAGE_ORDER_LSB_FIRST);
+	uint32_t pixels[256];
+	for (uint32_t a = 0; a < 256; a++) {
+		uint32_t pixel = a << 24 | (uint32_t)(red * a + 0.5) << 16 |
+		                 (uint32_t)(green * a + 0.5) << 8 |
+		                 (uint32_t)(blue * a + 0.5);
+		pixels[a] = swap ? __builtin_bswap32(pixel) : pixel;
+	}
+
+	for (uint32_t y = 0; y < alpha_image->height; y++) {
+		const uint8_t *src = alpha_image->data + y * alpha_image->stride;
+		uint32_t *dst = (uint32_t *)(ximage->data + y * ximage->stride);
+		for (uint32_t x = 0; x < alpha_image->width; x++)
+			dst[x] = pixels[src[x]];
 	}
 
+	xcb_image_destroy(alpha_image);
 	return ximage;
 }
 
@@ -179,52 +228,41 @@ xcb_image_t *make_shadow(xcb_connection_t *c, const conv *kernel,
  * Generate shadow <code>Picture</code> for a window.
  */
 bool build_shadow(session_t *ps, double opacity, const int width, const int height,
-                  xcb_render_picture_t shadow_pixel, xcb_pixmap_t *pixmap,
-                  xcb_render_picture_t *pict) {
+                  xcb_pixmap_t *pixmap, xcb_render_picture_t *pict) {
 	xcb_image_t *shadow_image = NULL;
-	xcb_pixmap_t shadow_pixmap = XCB_NONE, shadow_pixmap_argb = XCB_NONE;
-	xcb_render_picture_t shadow_picture = XCB_NONE, shadow_picture_argb = XCB_NONE;
+	xcb_pixmap_t shadow_pixmap = XCB_NONE;
+	xcb_render_picture_t shadow_picture = XCB_NONE;
 	xcb_gcontext_t gc = XCB_NONE;
 
-	shadow_image =
-	    make_shadow(ps->c, ps->gaussian_map, opacity, width, height);
+	shadow_image = make_shadow_argb(ps->c, ps->gaussian_map, opacity, width, height,
+	                                ps->o.shadow_red, ps->o.shadow_green,
+	                                ps->o.shadow_blue);
 	if (!shadow_image) {
 		log_error("Failed to make shadow");
 		return false;
 	}
 
 	shadow_pixmap =
-	    x_create_pixmap(ps, 8, ps->root, shadow_image->width, shadow_image->height);
-	shadow_pixmap_argb =
 	    x_create_pixmap(ps, 32, ps->root, shadow_image->width, shadow_image->height);
-
-	if (!shadow_pixmap || !shadow_pixmap_argb) {
-		log_error("Failed to create shadow pixmaps");
+	if (!shadow_pixmap) {
+		log_error("Failed to create shadow pixmap");
 		goto shadow_picture_err;
 	}
 
 	shadow_picture = x_create_picture_with_standard_and_pixmap(
-	    ps, XCB_PICT_STANDARD_A_8, shadow_pixmap, 0, NULL);
-	shadow_picture_argb = x_create_picture_with_standard_and_pixmap(
-	    ps, XCB_PICT_STANDARD_ARGB_32, shadow_pixmap_argb, 0, NULL);
-	if (!shadow_picture || !shadow_picture_argb)
+	    ps, XCB_PICT_STANDARD_ARGB_32, shadow_pixmap, 0, NULL);
+	if (!shadow_picture)
 		goto shadow_picture_err;
 
 	gc = xcb_generate_id(ps->c);
 	xcb_create_gc(ps->c, gc, shadow_pixmap, 0, NULL);
+	x_put_image(ps, shadow_pixmap, gc, shadow_image, 0, 0);
 
-	xcb_image_put(ps->c, shadow_pixmap, gc, shadow_image, 0, 0, 0);
-	xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, shadow_pixel, shadow_picture,
-	                     shadow_picture_argb, 0, 0, 0, 0, 0, 0, shadow_image->width,
-	                     shadow_image->height);
-
-	*pixmap = shadow_pixmap_argb;
-	*pict = shadow_picture_argb;
+	*pixmap = shadow_pixmap;
+	*pict = shadow_picture;
 
 	xcb_free_gc(ps->c, gc);
 	xcb_image_destroy(shadow_image);
-	xcb_free_pixmap(ps->c, shadow_pixmap);
-	xcb_render_free_picture(ps->c, shadow_picture);
 
 	return true;
 
@@ -233,14 +271,6 @@ shadow_picture_err:
 		xcb_image_destroy(shadow_image);
 	if (shadow_pixmap)
 		xcb_free_pixmap(ps->c, shadow_pixmap);
-	if (shadow_pixmap_argb)
-		xcb_free_pixmap(ps->c, shadow_pixmap_argb);
-	if (shadow_picture)
-		xcb_render_free_picture(ps->c, shadow_picture);
-	if (shadow_picture_argb)
-		xcb_render_free_picture(ps->c, shadow_picture_argb);
-	if (gc)
-		xcb_free_gc(ps->c, gc);
 
 	return false;
 }
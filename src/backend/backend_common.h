@@ -11,11 +11,16 @@ typedef struct win win;
 typedef struct conv conv;
 
 bool build_shadow(session_t *ps, double opacity, const int width, const int height,
-                  xcb_render_picture_t shadow_pixel, xcb_pixmap_t *pixmap,
-                  xcb_render_picture_t *pict);
+                  xcb_pixmap_t *pixmap, xcb_render_picture_t *pict);
 
 xcb_render_picture_t
 solid_picture(session_t *ps, bool argb, double a, double r, double g, double b);
 
 xcb_image_t *
 make_shadow(xcb_connection_t *c, const conv *kernel, double opacity, int width, int height);
+
+/// Make a shadow image in premultiplied ARGB32 of a color, ready to be uploaded
+/// to a 32-bit pixmap
+xcb_image_t *make_shadow_argb(xcb_connection_t *c, const conv *kernel, double opacity,
+                              int width, int height, double red, double green,
+                              double blue);
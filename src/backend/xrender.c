@@ -46,9 +46,6 @@ typedef struct _xrender_data {
 	xcb_render_picture_t white_pixel;
 	/// 1x1 black picture
 	xcb_render_picture_t black_pixel;
-
-	/// 1x1 picture of the shadow color
-	xcb_render_picture_t shadow_pixel;
 } xrender_data;
 
 #if 0
@@ -338,7 +335,6 @@ render_win(void *backend_data, session_t *ps, win *w, void *win_data, const regi
 
 static void *prepare_win(void *backend_data, session_t *ps, win *w) {
 	auto wd = ccalloc(1, struct _xrender_win_data);
-	struct _xrender_data *xd = backend_data;
 	assert(w->a.map_state == XCB_MAP_STATE_VIEWABLE);
 	if (ps->has_name_pixmap) {
 		wd->pixmap = xcb_generate_id(ps->c);
@@ -349,7 +345,7 @@ static void *prepare_win(void *backend_data, session_t *ps, win *w) {
 	if (!draw)
 		draw = w->id;
 
-	log_trace("%s %x", w->name, wd->pixmap);
+	log_trace("%s %x", istr_str(w->name), wd->pixmap);
 	wd->pict = x_create_picture_with_pictfmt_and_pixmap(ps, w->pictfmt, draw, 0, NULL);
 	wd->buffer = XCB_NONE;
 
@@ -362,7 +358,7 @@ static void *prepare_win(void *backend_data, session_t *ps, win *w) {
 	//     leave this here until we have chance to re-think the backend API
 	if (w->shadow) {
 		xcb_pixmap_t pixmap;
-		build_shadow(ps, 1, w->widthb, w->heightb, xd->shadow_pixel, &pixmap, &wd->shadow_pict);
+		build_shadow(ps, 1, w->widthb, w->heightb, &pixmap, &wd->shadow_pict);
 		xcb_free_pixmap(ps->c, pixmap);
 	}
 	return wd;
@@ -390,8 +386,6 @@ static void *init(session_t *ps) {
 
 	xd->black_pixel = solid_picture(ps, true, 1, 0, 0, 0);
 	xd->white_pixel = solid_picture(ps, true, 1, 1, 1, 1);
-	xd->shadow_pixel =
-	    solid_picture(ps, true, 1, ps->o.shadow_red, ps->o.shadow_green, ps->o.shadow_blue);
 
 	if (ps->overlay != XCB_NONE) {
 		xd->target =
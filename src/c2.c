@@ -40,6 +40,7 @@
 #include "log.h"
 #include "x.h"
 #include "compiler.h"
+#include "uthash.h"
 
 #include "c2.h"
 
@@ -112,6 +113,9 @@ struct _c2_l {
   bool match_ignorecase : 1;
   char *tgt;
   xcb_atom_t tgtatom;
+  /// Pending InternAtom request for <code>tgt</code>, only valid during
+  /// postprocessing.
+  xcb_intern_atom_cookie_t tgtatom_cookie;
   bool tgt_onframe;
   int index;
   enum {
@@ -156,11 +160,16 @@ struct _c2_l {
     C2_L_PTINT,
   } ptntype;
   char *ptnstr;
+  /// Interned <code>ptnstr</code>, for comparing with interned targets.
+  istr_t *ptnistr;
   long ptnint;
 #ifdef CONFIG_REGEX_PCRE
   pcre *regex_pcre;
   pcre_extra *regex_pcre_extra;
 #endif
+  /// Index of the leaf in the session's table of distinct leaves. Leaves
+  /// that only differ in negation share the same index.
+  int id;
 };
 
 /// Initializer for c2_l_t.
@@ -178,16 +187,132 @@ struct _c2_l {
   .format = 0, \
   .ptntype = C2_L_PTUNDEFINED, \
   .ptnstr = NULL, \
+  .ptnistr = NULL, \
   .ptnint = 0, \
+  .id = -1, \
 }
 
 static const c2_l_t leaf_def = C2_L_INIT;
 
+/// Condition matching state shared by all condition lists of a session.
+struct c2_state {
+  /// Distinct leaves of all condition lists, indexed by their id.
+  const c2_l_t **leaves;
+  int nleaves;
+  int leaves_cap;
+  /// Window whose leaf results are currently memoized, see
+  /// c2_match_begin().
+  const win *memo_win;
+  /// Memoized leaf results, before negation, indexed by leaf id.
+  enum {
+    C2_MEMO_UNKNOWN = 0,
+    C2_MEMO_FALSE,
+    C2_MEMO_TRUE,
+  } *memo;
+#ifdef CONFIG_REGEX_PCRE
+  /// Compiled regular expressions, shared by all leaves using them.
+  struct c2_regex *regexes;
+#endif
+};
+
+#ifdef CONFIG_REGEX_PCRE
+/// A compiled regular expression.
+struct c2_regex {
+  /// 'i' for case insensitive patterns, '-' otherwise, followed by the
+  /// pattern.
+  char *key;
+  pcre *regex;
+  pcre_extra *extra;
+  UT_hash_handle hh;
+};
+#endif
+
+/// Predefined string targets rules can be indexed by.
+static const int C2_INDEXED_PREDEFS[] = {
+  C2_L_PCLASSG,
+  C2_L_PCLASSI,
+  C2_L_PNAME,
+  C2_L_PROLE,
+  C2_L_PWINDOWTYPE,
+};
+
+#define C2_NUM_INDEXED_PREDEFS \
+  (sizeof(C2_INDEXED_PREDEFS) / sizeof(C2_INDEXED_PREDEFS[0]))
+
+/// Minimum number of conditions in a list for it to be indexed.
+#define C2_INDEX_MIN_CONDS 8
+
+/// Conditions of a list requiring a predefined target to equal a string.
+struct c2_bucket {
+  const char *value;
+  /// Positions of the conditions in the list, ascending.
+  int *conds;
+  int nconds;
+  UT_hash_handle hh;
+};
+
+/// Index of a condition list, to skip conditions that can't match a window.
+///
+/// Every condition that can only match if a predefined string target equals
+/// a certain value goes into the bucket for that target and value. The rest
+/// are residual and always tried.
+struct c2_index {
+  /// Conditions of the list by position.
+  const c2_lptr_t **conds;
+  int nconds;
+  /// Buckets for each of <code>C2_INDEXED_PREDEFS</code>, keyed by value.
+  struct c2_bucket *buckets[C2_NUM_INDEXED_PREDEFS];
+  /// Positions of the residual conditions, ascending.
+  int *residual;
+  int nresidual;
+};
+
+/// Instruction of a compiled condition list.
+///
+/// A condition list is compiled into a flat array of instructions operating
+/// on a single boolean result register. Each condition is followed by a
+/// <code>C2_I_MATCH</code>, and the list ends with <code>C2_I_END</code>.
+typedef struct {
+  enum {
+    /// Match a leaf, storing the result.
+    C2_I_LEAF,
+    /// Store false.
+    C2_I_FALSE,
+    /// Negate the result.
+    C2_I_NOT,
+    /// Jump to <code>target</code> if the result is false.
+    C2_I_JF,
+    /// Jump to <code>target</code> if the result is true.
+    C2_I_JT,
+    /// End of a condition, <code>lptr</code> matches if the result is true.
+    C2_I_MATCH,
+    /// End of the list.
+    C2_I_END,
+  } op;
+  union {
+    const c2_l_t *leaf;
+    int target;
+    const c2_lptr_t *lptr;
+  };
+} c2_insn_t;
+
 /// Linked list type of conditions.
 struct _c2_lptr {
   c2_ptr_t ptr;
   void *data;
   struct _c2_lptr *next;
+  /// Compiled program of the list starting here, only set on the head.
+  c2_insn_t *prog;
+  /// Index of the list starting here, only set on the head of long lists.
+  struct c2_index *index;
+  /// Index of the first instruction of this condition in the program.
+  int prog_start;
+  /// Window attributes the list starting here depends on, a mask of
+  /// <code>enum c2_dep</code>. Only set on the head.
+  unsigned deps;
+  /// Properties the list starting here depends on, only set on the head.
+  xcb_atom_t *dep_atoms;
+  int ndep_atoms;
 };
 
 /// Initializer for c2_lptr_t.
@@ -195,6 +320,12 @@ struct _c2_lptr {
   .ptr = C2_PTR_INIT, \
   .data = NULL, \
   .next = NULL, \
+  .prog = NULL, \
+  .index = NULL, \
+  .prog_start = 0, \
+  .deps = 0, \
+  .dep_atoms = NULL, \
+  .ndep_atoms = 0, \
 }
 
 /// Structure representing a predefined target.
@@ -355,6 +486,21 @@ c2_get_atom_type(const c2_l_t *pleaf);
 static bool
 c2_match_once(session_t *ps, win *w, const c2_ptr_t cond);
 
+static void
+c2_list_compile(c2_lptr_t *list);
+
+static void
+c2_l_assign_id(session_t *ps, c2_l_t *pleaf);
+
+static void
+c2_list_build_index(c2_lptr_t *list);
+
+static void
+c2_index_free(struct c2_index *index);
+
+static const char *
+c2_predef_str(const win *w, int predef);
+
 /**
  * Parse a condition string.
  */
@@ -1046,6 +1192,128 @@ fail:
 
 #undef c2_error
 
+/**
+ * Return whether two leaves always give the same result before negation.
+ */
+static bool
+c2_l_equal(const c2_l_t *a, const c2_l_t *b) {
+  if (a->op != b->op || a->match != b->match
+      || a->match_ignorecase != b->match_ignorecase
+      || a->predef != b->predef || a->tgtatom != b->tgtatom
+      || a->tgt_onframe != b->tgt_onframe || a->index != b->index
+      || a->type != b->type || a->format != b->format
+      || a->ptntype != b->ptntype || a->ptnint != b->ptnint)
+    return false;
+
+  if (!a->ptnstr || !b->ptnstr)
+    return a->ptnstr == b->ptnstr;
+  return !strcmp(a->ptnstr, b->ptnstr);
+}
+
+/**
+ * Get the condition matching state of a session, creating it if needed.
+ */
+static struct c2_state *
+c2_get_state(session_t *ps) {
+  if (!ps->c2_state)
+    ps->c2_state = ccalloc(1, struct c2_state);
+  return ps->c2_state;
+}
+
+#ifdef CONFIG_REGEX_PCRE
+/**
+ * Compile the regular expression of a leaf.
+ *
+ * Each distinct pattern is only compiled and studied once per session, and
+ * the result is shared by all leaves using it.
+ */
+static bool
+c2_l_compile_regex(session_t *ps, c2_l_t *pleaf) {
+  struct c2_state *st = c2_get_state(ps);
+
+  char *key = NULL;
+  mstrextend(&key, pleaf->match_ignorecase ? "i": "-");
+  mstrextend(&key, pleaf->ptnstr);
+
+  struct c2_regex *cached = NULL;
+  HASH_FIND_STR(st->regexes, key, cached);
+  if (cached) {
+    free(key);
+    pleaf->regex_pcre = cached->regex;
+    pleaf->regex_pcre_extra = cached->extra;
+    return true;
+  }
+
+  const char *error = NULL;
+  int erroffset = 0;
+  int options = 0;
+
+  // Ignore case flag
+  if (pleaf->match_ignorecase)
+    options |= PCRE_CASELESS;
+
+  // Compile PCRE expression
+  pcre *regex = pcre_compile(pleaf->ptnstr, options, &error, &erroffset, NULL);
+  if (!regex) {
+    log_error("Pattern \"%s\": PCRE regular expression parsing failed on "
+        "offset %d: %s", pleaf->ptnstr, erroffset, error);
+    free(key);
+    return false;
+  }
+
+  // Studying pays off even without JIT, as every pattern is matched many
+  // times. A NULL result without an error just means there was nothing to
+  // gain.
+#ifdef CONFIG_REGEX_PCRE_JIT
+  const int study_options = PCRE_STUDY_JIT_COMPILE;
+#else
+  const int study_options = 0;
+#endif
+  error = NULL;
+  pcre_extra *extra = pcre_study(regex, study_options, &error);
+  if (error) {
+    log_warn("Pattern \"%s\": PCRE regular expression study failed: %s",
+        pleaf->ptnstr, error);
+  }
+
+  cached = cmalloc(struct c2_regex);
+  cached->key = key;
+  cached->regex = regex;
+  cached->extra = extra;
+  HASH_ADD_KEYPTR(hh, st->regexes, cached->key, strlen(cached->key), cached);
+
+  pleaf->regex_pcre = regex;
+  pleaf->regex_pcre_extra = extra;
+  return true;
+}
+#endif
+
+/**
+ * Give a leaf the id of an equal leaf seen before, or a new one.
+ *
+ * This lets leaves repeated across condition lists be evaluated once per
+ * window, see c2_match_begin().
+ */
+static void
+c2_l_assign_id(session_t *ps, c2_l_t *pleaf) {
+  struct c2_state *st = c2_get_state(ps);
+
+  for (int i = 0; i < st->nleaves; i++) {
+    if (c2_l_equal(st->leaves[i], pleaf)) {
+      pleaf->id = i;
+      return;
+    }
+  }
+
+  if (st->nleaves == st->leaves_cap) {
+    st->leaves_cap = st->leaves_cap ? st->leaves_cap * 2: 16;
+    st->leaves = crealloc(st->leaves, st->leaves_cap);
+    st->memo = crealloc(st->memo, st->leaves_cap);
+  }
+  pleaf->id = st->nleaves;
+  st->leaves[st->nleaves++] = pleaf;
+}
+
 /**
  * Do postprocessing on a condition leaf.
  */
@@ -1057,9 +1325,15 @@ c2_l_postprocess(session_t *ps, c2_l_t *pleaf) {
       (C2_L_TSTRING == pleaf->type ? C2_L_PTSTRING: C2_L_PTINT);
   }
 
-  // Get target atom if it's not a predefined one
+  // Get target atom if it's not a predefined one. The request has been sent
+  // by c2_tree_intern_atoms(), collect the reply.
   if (!pleaf->predef) {
-    pleaf->tgtatom = get_atom(ps, pleaf->tgt);
+    xcb_intern_atom_reply_t *reply =
+      xcb_intern_atom_reply(ps->c, pleaf->tgtatom_cookie, NULL);
+    if (reply) {
+      pleaf->tgtatom = reply->atom;
+      free(reply);
+    }
     if (!pleaf->tgtatom) {
       log_error("Failed to get atom for target \"%s\".", pleaf->tgt);
       return false;
@@ -1108,33 +1382,14 @@ c2_l_postprocess(session_t *ps, c2_l_t *pleaf) {
     }
   }
 
+  if (C2_L_PTSTRING == pleaf->ptntype && pleaf->ptnstr)
+    pleaf->ptnistr = istr_get(pleaf->ptnstr);
+
   // PCRE patterns
   if (C2_L_PTSTRING == pleaf->ptntype && C2_L_MPCRE == pleaf->match) {
 #ifdef CONFIG_REGEX_PCRE
-    const char *error = NULL;
-    int erroffset = 0;
-    int options = 0;
-
-    // Ignore case flag
-    if (pleaf->match_ignorecase)
-      options |= PCRE_CASELESS;
-
-    // Compile PCRE expression
-    pleaf->regex_pcre = pcre_compile(pleaf->ptnstr, options,
-        &error, &erroffset, NULL);
-    if (!pleaf->regex_pcre) {
-      log_error("Pattern \"%s\": PCRE regular expression parsing failed on "
-          "offset %d: %s", pleaf->ptnstr, erroffset, error);
+    if (!c2_l_compile_regex(ps, pleaf))
       return false;
-    }
-#ifdef CONFIG_REGEX_PCRE_JIT
-    pleaf->regex_pcre_extra = pcre_study(pleaf->regex_pcre,
-        PCRE_STUDY_JIT_COMPILE, &error);
-    if (!pleaf->regex_pcre_extra) {
-      printf("Pattern \"%s\": PCRE regular expression study failed: %s",
-          pleaf->ptnstr, error);
-    }
-#endif
 
     // Free the target string
     // free(pleaf->tgt);
@@ -1145,9 +1400,27 @@ c2_l_postprocess(session_t *ps, c2_l_t *pleaf) {
 #endif
   }
 
+  c2_l_assign_id(ps, pleaf);
+
   return true;
 }
 
+/**
+ * Send InternAtom requests for the targets of all leaves in a condition
+ * tree, so they can be resolved in one round trip.
+ */
+static void c2_tree_intern_atoms(session_t *ps, c2_ptr_t node) {
+  if (!node.isbranch) {
+    c2_l_t *pleaf = node.l;
+    if (!pleaf->predef)
+      pleaf->tgtatom_cookie =
+        xcb_intern_atom(ps->c, 0, strlen(pleaf->tgt), pleaf->tgt);
+    return;
+  }
+  c2_tree_intern_atoms(ps, node.b->opr1);
+  c2_tree_intern_atoms(ps, node.b->opr2);
+}
+
 static bool c2_tree_postprocess(session_t *ps, c2_ptr_t node) {
   if (!node.isbranch) {
     return c2_l_postprocess(ps, node.l);
@@ -1157,15 +1430,251 @@ static bool c2_tree_postprocess(session_t *ps, c2_ptr_t node) {
   return c2_tree_postprocess(ps, node.b->opr2);
 }
 
+/**
+ * Record the dependencies of a condition tree on the head of its list.
+ */
+static void c2_tree_collect_deps(c2_lptr_t *head, c2_ptr_t node) {
+  if (node.isbranch) {
+    if (node.b) {
+      c2_tree_collect_deps(head, node.b->opr1);
+      c2_tree_collect_deps(head, node.b->opr2);
+    }
+    return;
+  }
+
+  const c2_l_t *pleaf = node.l;
+  if (!pleaf)
+    return;
+
+  switch (pleaf->predef) {
+    case C2_L_PNAME:    head->deps |= C2_DEP_NAME;  break;
+    case C2_L_PCLASSG:
+    case C2_L_PCLASSI:  head->deps |= C2_DEP_CLASS; break;
+    case C2_L_PROLE:    head->deps |= C2_DEP_ROLE;  break;
+    default:            break;
+  }
+
+  if (!pleaf->tgtatom)
+    return;
+  for (int i = 0; i < head->ndep_atoms; ++i)
+    if (head->dep_atoms[i] == pleaf->tgtatom)
+      return;
+  head->dep_atoms = crealloc(head->dep_atoms, head->ndep_atoms + 1);
+  head->dep_atoms[head->ndep_atoms++] = pleaf->tgtatom;
+}
+
 bool c2_list_postprocess(session_t *ps, c2_lptr_t *list) {
+  for (c2_lptr_t *head = list; head; head = head->next)
+    c2_tree_intern_atoms(ps, head->ptr);
+
   c2_lptr_t *head = list;
   while (head) {
     if (!c2_tree_postprocess(ps, head->ptr))
       return false;
     head = head->next;
   }
+
+  for (head = list; head; head = head->next)
+    c2_tree_collect_deps(list, head->ptr);
+
+  c2_list_compile(list);
   return true;
 }
+
+/**
+ * Get the number of instructions a condition tree compiles to.
+ *
+ * @return the number of instructions, -1 if the tree can't be compiled
+ */
+static int
+c2_prog_size(c2_ptr_t node) {
+  if (!node.isbranch || !node.b)
+    return 1;
+
+  if (C2_B_OAND != node.b->op && C2_B_OOR != node.b->op)
+    return -1;
+
+  int size1 = c2_prog_size(node.b->opr1);
+  int size2 = c2_prog_size(node.b->opr2);
+  if (size1 < 0 || size2 < 0)
+    return -1;
+
+  return size1 + 1 + size2 + (node.b->neg ? 1: 0);
+}
+
+/**
+ * Emit the instructions of a condition tree.
+ *
+ * @return index of the instruction following the emitted ones
+ */
+static int
+c2_prog_emit(c2_insn_t *prog, int pos, c2_ptr_t node) {
+  if (!node.isbranch) {
+    if (node.l)
+      prog[pos++] = (c2_insn_t) { .op = C2_I_LEAF, .leaf = node.l };
+    else
+      prog[pos++] = (c2_insn_t) { .op = C2_I_FALSE };
+    return pos;
+  }
+
+  if (!node.b) {
+    prog[pos++] = (c2_insn_t) { .op = C2_I_FALSE };
+    return pos;
+  }
+
+  // Short-circuit: skip the second operand if the first one decides the
+  // result already
+  pos = c2_prog_emit(prog, pos, node.b->opr1);
+  int jump = pos++;
+  prog[jump].op = (C2_B_OAND == node.b->op ? C2_I_JF: C2_I_JT);
+  pos = c2_prog_emit(prog, pos, node.b->opr2);
+  prog[jump].target = pos;
+
+  if (node.b->neg)
+    prog[pos++] = (c2_insn_t) { .op = C2_I_NOT };
+
+  return pos;
+}
+
+/**
+ * Compile a condition list into a flat program, stored in its head.
+ *
+ * Lists containing operators the compiler doesn't support are left to the
+ * tree walking c2_match_once().
+ */
+static void
+c2_list_compile(c2_lptr_t *list) {
+  if (!list)
+    return;
+
+  int size = 1;
+  for (c2_lptr_t *p = list; p; p = p->next) {
+    int cond_size = c2_prog_size(p->ptr);
+    if (cond_size < 0)
+      return;
+    size += cond_size + 1;
+  }
+
+  auto prog = ccalloc(size, c2_insn_t);
+  int pos = 0;
+  for (c2_lptr_t *p = list; p; p = p->next) {
+    p->prog_start = pos;
+    pos = c2_prog_emit(prog, pos, p->ptr);
+    prog[pos++] = (c2_insn_t) { .op = C2_I_MATCH, .lptr = p };
+  }
+  prog[pos++] = (c2_insn_t) { .op = C2_I_END };
+  assert(pos == size);
+
+  // Thread jumps: a jump landing on a jump of the same kind can go straight
+  // to its target, and one landing on the opposite kind falls through it.
+  for (int i = 0; i < size; i++) {
+    if (C2_I_JF != prog[i].op && C2_I_JT != prog[i].op)
+      continue;
+    int target = prog[i].target;
+    while (C2_I_JF == prog[target].op || C2_I_JT == prog[target].op) {
+      if (prog[target].op == prog[i].op)
+        target = prog[target].target;
+      else
+        target++;
+    }
+    prog[i].target = target;
+  }
+
+  list->prog = prog;
+  log_debug("Compiled condition list %p into %d instructions", list, size);
+
+  c2_list_build_index(list);
+}
+
+/**
+ * Find a leaf a condition can't match without, that requires a predefined
+ * string target to equal a string.
+ */
+static const c2_l_t *
+c2_index_leaf(c2_ptr_t node) {
+  if (node.isbranch) {
+    if (!node.b || node.b->neg || C2_B_OAND != node.b->op)
+      return NULL;
+    const c2_l_t *pleaf = c2_index_leaf(node.b->opr1);
+    return pleaf ? pleaf: c2_index_leaf(node.b->opr2);
+  }
+
+  const c2_l_t *pleaf = node.l;
+  if (!pleaf || pleaf->neg || C2_L_OEQ != pleaf->op
+      || C2_L_MEXACT != pleaf->match || pleaf->match_ignorecase
+      || C2_L_PTSTRING != pleaf->ptntype || !pleaf->ptnstr)
+    return NULL;
+
+  for (size_t i = 0; i < C2_NUM_INDEXED_PREDEFS; i++)
+    if (C2_INDEXED_PREDEFS[i] == (int) pleaf->predef)
+      return pleaf;
+  return NULL;
+}
+
+/**
+ * Build the index of a compiled condition list.
+ */
+static void
+c2_list_build_index(c2_lptr_t *list) {
+  int nconds = 0;
+  for (c2_lptr_t *p = list; p; p = p->next)
+    nconds++;
+  if (nconds < C2_INDEX_MIN_CONDS)
+    return;
+
+  auto index = ccalloc(1, struct c2_index);
+  index->conds = ccalloc(nconds, const c2_lptr_t *);
+  index->residual = ccalloc(nconds, int);
+
+  int pos = 0;
+  for (c2_lptr_t *p = list; p; p = p->next, pos++) {
+    index->conds[pos] = p;
+
+    const c2_l_t *pleaf = c2_index_leaf(p->ptr);
+    if (!pleaf) {
+      index->residual[index->nresidual++] = pos;
+      continue;
+    }
+
+    size_t t = 0;
+    while (C2_INDEXED_PREDEFS[t] != (int) pleaf->predef)
+      t++;
+
+    struct c2_bucket *bucket = NULL;
+    HASH_FIND_STR(index->buckets[t], pleaf->ptnstr, bucket);
+    if (!bucket) {
+      bucket = ccalloc(1, struct c2_bucket);
+      bucket->value = pleaf->ptnstr;
+      HASH_ADD_KEYPTR(hh, index->buckets[t], bucket->value,
+          strlen(bucket->value), bucket);
+    }
+    bucket->conds = crealloc(bucket->conds, bucket->nconds + 1);
+    bucket->conds[bucket->nconds++] = pos;
+  }
+  index->nconds = nconds;
+
+  list->index = index;
+  log_debug("Indexed condition list %p, %d of %d conditions are residual",
+      list, index->nresidual, nconds);
+}
+
+static void
+c2_index_free(struct c2_index *index) {
+  if (!index)
+    return;
+
+  for (size_t t = 0; t < C2_NUM_INDEXED_PREDEFS; t++) {
+    struct c2_bucket *bucket, *tmp;
+    HASH_ITER(hh, index->buckets[t], bucket, tmp) {
+      HASH_DEL(index->buckets[t], bucket);
+      free(bucket->conds);
+      free(bucket);
+    }
+  }
+  free(index->conds);
+  free(index->residual);
+  free(index);
+}
 /**
  * Free a condition tree.
  */
@@ -1189,12 +1698,10 @@ c2_free(c2_ptr_t p) {
     if (!pleaf)
       return;
 
+    // Compiled regular expressions are owned by the session's c2_state
     free(pleaf->tgt);
     free(pleaf->ptnstr);
-#ifdef CONFIG_REGEX_PCRE
-    pcre_free(pleaf->regex_pcre);
-    LPCRE_FREE_STUDY(pleaf->regex_pcre_extra);
-#endif
+    istr_unref(&pleaf->ptnistr);
     free(pleaf);
   }
 }
@@ -1209,6 +1716,9 @@ c2_free_lptr(c2_lptr_t *lp) {
 
   c2_lptr_t *pnext = lp->next;
   c2_free(lp->ptr);
+  free(lp->prog);
+  free(lp->dep_atoms);
+  c2_index_free(lp->index);
   free(lp);
 
   return pnext;
@@ -1359,6 +1869,183 @@ c2_get_atom_type(const c2_l_t *pleaf) {
   unreachable;
 }
 
+/// A raw window property value fetched for condition matching.
+struct c2_prop {
+  struct c2_prop *next;
+  xcb_window_t wid;
+  xcb_atom_t atom;
+  int idx;
+  /// Requested type, <code>XCB_NONE</code> for a text property.
+  xcb_atom_t type;
+  int format;
+  /// Whether the property exists with the requested type and format.
+  bool exists;
+  long ival;
+  char *str;
+};
+
+static void
+c2_prop_free(struct c2_prop *prop) {
+  free(prop->str);
+  free(prop);
+}
+
+/**
+ * Drop the cached values of a property of a window.
+ *
+ * Must be called when the property changes.
+ */
+void
+c2_prop_cache_invalidate(win *w, xcb_window_t wid, xcb_atom_t atom) {
+  for (struct c2_prop **pprop = &w->c2_props; *pprop; ) {
+    struct c2_prop *prop = *pprop;
+    if (prop->wid == wid && prop->atom == atom) {
+      *pprop = prop->next;
+      c2_prop_free(prop);
+    } else
+      pprop = &prop->next;
+  }
+}
+
+/**
+ * Drop all cached property values of a window.
+ */
+void
+c2_prop_cache_clear(win *w) {
+  struct c2_prop *next = NULL;
+  for (struct c2_prop *prop = w->c2_props; prop; prop = next) {
+    next = prop->next;
+    c2_prop_free(prop);
+  }
+  w->c2_props = NULL;
+}
+
+/**
+ * Find a cached property value, or allocate an empty entry for it.
+ *
+ * The cache is only used for mapped windows, as we only receive
+ * PropertyNotify for those. Returns NULL if the window isn't mapped, and
+ * sets <code>*pfound</code> to whether the entry was already cached.
+ */
+static struct c2_prop *
+c2_prop_cache_get(session_t *ps, win *w, xcb_window_t wid, xcb_atom_t atom,
+    int idx, xcb_atom_t type, int format, bool *pfound) {
+  *pfound = false;
+  if (w->a.map_state != XCB_MAP_STATE_VIEWABLE)
+    return NULL;
+
+  for (struct c2_prop *prop = w->c2_props; prop; prop = prop->next) {
+    if (prop->wid == wid && prop->atom == atom && prop->idx == idx
+        && prop->type == type && prop->format == format) {
+      ps->nc2_prop_cache_hits++;
+      *pfound = true;
+      return prop;
+    }
+  }
+
+  ps->nc2_prop_cache_misses++;
+  auto prop = ccalloc(1, struct c2_prop);
+  prop->wid = wid;
+  prop->atom = atom;
+  prop->idx = idx;
+  prop->type = type;
+  prop->format = format;
+  prop->next = w->c2_props;
+  w->c2_props = prop;
+  return prop;
+}
+
+/**
+ * Get a single integer item of a window property, through the cache.
+ *
+ * @return true if the property exists with the requested type and format
+ */
+static bool
+c2_get_prop_int(session_t *ps, win *w, xcb_window_t wid, xcb_atom_t atom,
+    int idx, xcb_atom_t type, int format, long *pval) {
+  bool found;
+  struct c2_prop *cached =
+    c2_prop_cache_get(ps, w, wid, atom, idx, type, format, &found);
+  if (found) {
+    *pval = cached->ival;
+    return cached->exists;
+  }
+
+  winprop_t prop = wid_get_prop_adv(ps, wid, atom, idx, 1L, type, format);
+  bool exists = prop.nitems;
+  *pval = winprop_get_int(prop);
+  free_winprop(&prop);
+
+  if (cached) {
+    cached->exists = exists;
+    cached->ival = *pval;
+  }
+  return exists;
+}
+
+/**
+ * Get a string from a text property of a window, through the cache.
+ *
+ * @return the string, or NULL if there is none. If <code>*pfree</code> is
+ *         set, the caller owns the string, otherwise the cache does.
+ */
+static const char *
+c2_get_prop_str(session_t *ps, win *w, xcb_window_t wid, xcb_atom_t atom,
+    int idx, char **pfree) {
+  bool found;
+  struct c2_prop *cached =
+    c2_prop_cache_get(ps, w, wid, atom, idx, XCB_NONE, 0, &found);
+  *pfree = NULL;
+  if (found)
+    return cached->str;
+
+  char **strlst = NULL;
+  int nstr;
+  char *str = NULL;
+  if (wid_get_text_prop(ps, wid, atom, &strlst, &nstr) && nstr > idx)
+    str = strdup(strlst[idx]);
+  if (strlst)
+    XFreeStringList(strlst);
+
+  if (cached) {
+    cached->exists = str;
+    cached->str = str;
+  } else
+    *pfree = str;
+  return str;
+}
+
+/**
+ * Get the value of a predefined string target of a window, if it's
+ * interned.
+ */
+static const istr_t *
+c2_predef_istr(const win *w, int predef) {
+  switch (predef) {
+    case C2_L_PNAME:        return w->name;
+    case C2_L_PCLASSG:      return w->class_general;
+    case C2_L_PCLASSI:      return w->class_instance;
+    case C2_L_PROLE:        return w->role;
+    default:                return NULL;
+  }
+}
+
+/**
+ * Get the value of a predefined string target of a window.
+ */
+static const char *
+c2_predef_str(const win *w, int predef) {
+  switch (predef) {
+    case C2_L_PWINDOWTYPE:  return WINTYPES[w->window_type];
+    case C2_L_PNAME:
+    case C2_L_PCLASSG:
+    case C2_L_PCLASSI:
+    case C2_L_PROLE:        return istr_str(c2_predef_istr(w, predef));
+    default:                assert(0);
+  }
+  unreachable;
+}
+
 /**
  * Match a window against a single leaf window condition.
  *
@@ -1412,13 +2099,9 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
         }
         // A raw window property
         else {
-          winprop_t prop = wid_get_prop_adv(ps, wid, pleaf->tgtatom,
-              idx, 1L, c2_get_atom_type(pleaf), pleaf->format);
-          if (prop.nitems) {
+          if (c2_get_prop_int(ps, w, wid, pleaf->tgtatom, idx,
+                c2_get_atom_type(pleaf), pleaf->format, &tgt))
             *perr = false;
-            tgt = winprop_get_int(prop);
-          }
-          free_winprop(&prop);
         }
 
         if (*perr)
@@ -1443,49 +2126,25 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
       {
         const char *tgt = NULL;
         char *tgt_free = NULL;
+        // Interned target, if any
+        const istr_t *itgt = NULL;
 
         // A predefined target
         if (pleaf->predef) {
-          switch (pleaf->predef) {
-            case C2_L_PWINDOWTYPE:  tgt = WINTYPES[w->window_type];
-                                    break;
-            case C2_L_PNAME:        tgt = w->name;            break;
-            case C2_L_PCLASSG:      tgt = w->class_general;   break;
-            case C2_L_PCLASSI:      tgt = w->class_instance;  break;
-            case C2_L_PROLE:        tgt = w->role;            break;
-            default:                assert(0);                break;
-          }
+          itgt = c2_predef_istr(w, pleaf->predef);
+          tgt = c2_predef_str(w, pleaf->predef);
         }
         // If it's an atom type property, convert atom to string
         else if (C2_L_TATOM == pleaf->type) {
-          winprop_t prop = wid_get_prop_adv(ps, wid, pleaf->tgtatom,
-              idx, 1L, c2_get_atom_type(pleaf), pleaf->format);
-          xcb_atom_t atom = winprop_get_int(prop);
-          if (atom) {
-            xcb_get_atom_name_reply_t *reply =
-              xcb_get_atom_name_reply(ps->c, xcb_get_atom_name(ps->c, atom), NULL);
-            if (reply) {
-              tgt_free = strndup(
-                  xcb_get_atom_name_name(reply), xcb_get_atom_name_name_length(reply));
-              free(reply);
-            }
-          }
-          if (tgt_free) {
-            tgt = tgt_free;
-          }
-          free_winprop(&prop);
+          long atom = 0;
+          c2_get_prop_int(ps, w, wid, pleaf->tgtatom, idx,
+              c2_get_atom_type(pleaf), pleaf->format, &atom);
+          if (atom)
+            tgt = x_get_atom_name(ps, atom);
         }
         // Otherwise, just fetch the string list
         else {
-          char **strlst = NULL;
-          int nstr;
-          if (wid_get_text_prop(ps, wid, pleaf->tgtatom, &strlst,
-              &nstr) && nstr > idx) {
-            tgt_free = strdup(strlst[idx]);
-            tgt = tgt_free;
-          }
-          if (strlst)
-            XFreeStringList(strlst);
+          tgt = c2_get_prop_str(ps, w, wid, pleaf->tgtatom, idx, &tgt_free);
         }
 
         if (tgt) {
@@ -1495,6 +2154,13 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
           return;
         }
 
+        // Both the target and the pattern are interned, so exact matches
+        // are pointer comparisons and case insensitive matches can use the
+        // pre-folded strings
+        const istr_t *iptn = pleaf->ptnistr;
+        if (!iptn)
+          itgt = NULL;
+
         // Actual matching
         switch (pleaf->op) {
           case C2_L_OEXISTS:
@@ -1503,19 +2169,32 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
           case C2_L_OEQ:
             switch (pleaf->match) {
               case C2_L_MEXACT:
-                if (pleaf->match_ignorecase)
+                if (itgt && pleaf->match_ignorecase)
+                  *pres = (itgt->folded_hash == iptn->folded_hash
+                      && !strcmp(itgt->folded, iptn->folded));
+                else if (itgt)
+                  *pres = (itgt == iptn);
+                else if (pleaf->match_ignorecase)
                   *pres = !strcasecmp(tgt, pleaf->ptnstr);
                 else
                   *pres = !strcmp(tgt, pleaf->ptnstr);
                 break;
               case C2_L_MCONTAINS:
-                if (pleaf->match_ignorecase)
+                if (itgt && pleaf->match_ignorecase)
+                  *pres = strstr(itgt->folded, iptn->folded);
+                else if (pleaf->match_ignorecase)
                   *pres = strcasestr(tgt, pleaf->ptnstr);
                 else
                   *pres = strstr(tgt, pleaf->ptnstr);
                 break;
               case C2_L_MSTART:
-                if (pleaf->match_ignorecase)
+                if (itgt && pleaf->match_ignorecase)
+                  *pres = (itgt->len >= iptn->len
+                      && !memcmp(itgt->folded, iptn->folded, iptn->len));
+                else if (itgt)
+                  *pres = (itgt->len >= iptn->len
+                      && !memcmp(tgt, iptn->str, iptn->len));
+                else if (pleaf->match_ignorecase)
                   *pres = !strncasecmp(tgt, pleaf->ptnstr,
                       strlen(pleaf->ptnstr));
                 else
@@ -1534,7 +2213,8 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
 #ifdef CONFIG_REGEX_PCRE
                 *pres = (pcre_exec(pleaf->regex_pcre,
                       pleaf->regex_pcre_extra,
-                      tgt, strlen(tgt), 0, 0, NULL, 0) >= 0);
+                      tgt, itgt ? (int) itgt->len: (int) strlen(tgt),
+                      0, 0, NULL, 0) >= 0);
 #else
                 assert(0);
 #endif
@@ -1547,12 +2227,7 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
         }
 
         // Free the string after usage, if necessary
-        if (tgt_free) {
-          if (C2_L_TATOM == pleaf->type)
-            cxfree(tgt_free);
-          else
-            free(tgt_free);
-        }
+        free(tgt_free);
       }
       break;
     default:
@@ -1561,6 +2236,118 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
   }
 }
 
+/**
+ * Match a window against a single leaf, with its negation applied.
+ */
+static bool
+c2_match_leaf(session_t *ps, win *w, const c2_l_t *pleaf) {
+  struct c2_state *st = ps->c2_state;
+  bool memoize = st && st->memo_win == w && pleaf->id >= 0;
+  if (memoize && st->memo[pleaf->id] != C2_MEMO_UNKNOWN) {
+    bool result = (C2_MEMO_TRUE == st->memo[pleaf->id]);
+    return pleaf->neg ? !result: result;
+  }
+
+  bool result = false;
+  bool error = true;
+
+  c2_match_once_leaf(ps, w, pleaf, &result, &error);
+
+  // For EXISTS operator, no errors are fatal
+  if (C2_L_OEXISTS == pleaf->op && error) {
+    result = false;
+    error = false;
+  }
+
+#ifdef DEBUG_WINMATCH
+  log_trace("(%#010lx): leaf: result = %d, error = %d, "
+            "client = %#010lx,  pattern = ",
+            w->id, result, error, w->client_win);
+  c2_dump((c2_ptr_t) { .isbranch = false, .l = (c2_l_t *) pleaf });
+#endif
+
+  if (error)
+    result = false;
+
+  if (memoize)
+    st->memo[pleaf->id] = result ? C2_MEMO_TRUE: C2_MEMO_FALSE;
+
+  return pleaf->neg ? !result: result;
+}
+
+/**
+ * Return whether a condition list depends on a window attribute or a
+ * property.
+ *
+ * @param deps mask of <code>enum c2_dep</code>
+ * @param atom the property, or XCB_NONE
+ */
+bool
+c2_list_depends_on(const c2_lptr_t *list, unsigned deps, xcb_atom_t atom) {
+  if (!list)
+    return false;
+  if (list->deps & deps)
+    return true;
+  if (atom)
+    for (int i = 0; i < list->ndep_atoms; ++i)
+      if (list->dep_atoms[i] == atom)
+        return true;
+  return false;
+}
+
+/**
+ * Start memoizing leaf results for a window.
+ *
+ * Between this and c2_match_end(), every distinct leaf is evaluated at most
+ * once for the window, no matter how many condition lists contain it. The
+ * caller must make sure nothing a leaf depends on changes in between.
+ *
+ * @return false if results are being memoized already, in which case
+ *         c2_match_end() must not be called
+ */
+bool
+c2_match_begin(session_t *ps, const win *w) {
+  struct c2_state *st = ps->c2_state;
+  if (!st || st->memo_win)
+    return false;
+
+  memset(st->memo, 0, st->nleaves * sizeof(*st->memo));
+  st->memo_win = w;
+  return true;
+}
+
+/**
+ * Stop memoizing leaf results.
+ */
+void
+c2_match_end(session_t *ps) {
+  if (ps->c2_state)
+    ps->c2_state->memo_win = NULL;
+}
+
+/**
+ * Free the condition matching state of a session.
+ */
+void
+c2_state_free(session_t *ps) {
+  if (!ps->c2_state)
+    return;
+  free(ps->c2_state->leaves);
+  free(ps->c2_state->memo);
+#ifdef CONFIG_REGEX_PCRE
+  struct c2_regex *regex, *tmp;
+  HASH_ITER(hh, ps->c2_state->regexes, regex, tmp) {
+    HASH_DEL(ps->c2_state->regexes, regex);
+    pcre_free(regex->regex);
+    LPCRE_FREE_STUDY(regex->extra);
+    free(regex->key);
+    free(regex);
+  }
+#endif
+  free(ps->c2_state);
+  ps->c2_state = NULL;
+}
+
 /**
  * Match a window against a single window condition.
  *
@@ -1605,37 +2392,107 @@ c2_match_once(session_t *ps, win *w, const c2_ptr_t cond) {
   }
   // Handle a leaf
   else {
-    const c2_l_t *pleaf = cond.l;
-
-    if (!pleaf)
+    if (!cond.l)
       return false;
 
-    c2_match_once_leaf(ps, w, pleaf, &result, &error);
-
-    // For EXISTS operator, no errors are fatal
-    if (C2_L_OEXISTS == pleaf->op && error) {
-      result = false;
-      error = false;
-    }
-
-#ifdef DEBUG_WINMATCH
-    log_trace("(%#010lx): leaf: result = %d, error = %d, "
-              "client = %#010lx,  pattern = ",
-              w->id, result, error, w->client_win);
-    c2_dump(cond);
-#endif
+    return c2_match_leaf(ps, w, cond.l);
   }
 
   // Postprocess the result
   if (error)
     result = false;
 
-  if (cond.isbranch ? cond.b->neg: cond.l->neg)
+  if (cond.b->neg)
     result = !result;
 
   return result;
 }
 
+/**
+ * Run a compiled condition list.
+ *
+ * @param pc index of the first instruction to run
+ * @param single whether to stop after the first condition
+ * @return the matched condition, NULL if none matched
+ */
+static const c2_lptr_t *
+c2_prog_run(session_t *ps, win *w, const c2_insn_t *prog, int pc,
+    bool single) {
+  bool result = false;
+
+  while (true) {
+    const c2_insn_t *insn = &prog[pc++];
+    switch (insn->op) {
+      case C2_I_LEAF:   result = c2_match_leaf(ps, w, insn->leaf); break;
+      case C2_I_FALSE:  result = false;                           break;
+      case C2_I_NOT:    result = !result;                         break;
+      case C2_I_JF:     if (!result) pc = insn->target;           break;
+      case C2_I_JT:     if (result) pc = insn->target;            break;
+      case C2_I_MATCH:
+        if (result)
+          return insn->lptr;
+        if (single)
+          return NULL;
+        break;
+      case C2_I_END:    return NULL;
+    }
+  }
+}
+
+/**
+ * Run the conditions of an indexed list that could match a window, in list
+ * order.
+ *
+ * @return the first matching condition, NULL if none matched
+ */
+static const c2_lptr_t *
+c2_index_run(session_t *ps, win *w, const c2_lptr_t *list) {
+  const struct c2_index *index = list->index;
+
+  // Sorted runs of candidate positions: the residual conditions plus the
+  // bucket for the window's value of each indexed target
+  const int *runs[C2_NUM_INDEXED_PREDEFS + 1];
+  int lens[C2_NUM_INDEXED_PREDEFS + 1];
+  int nruns = 0;
+
+  if (index->nresidual) {
+    runs[nruns] = index->residual;
+    lens[nruns++] = index->nresidual;
+  }
+  for (size_t t = 0; t < C2_NUM_INDEXED_PREDEFS; t++) {
+    const char *value;
+    if (!index->buckets[t] || !(value = c2_predef_str(w, C2_INDEXED_PREDEFS[t])))
+      continue;
+    struct c2_bucket *bucket = NULL;
+    HASH_FIND_STR(index->buckets[t], value, bucket);
+    if (bucket) {
+      runs[nruns] = bucket->conds;
+      lens[nruns++] = bucket->nconds;
+    }
+  }
+
+  // Merge the runs, trying the conditions in list order
+  while (nruns) {
+    int min = 0;
+    for (int i = 1; i < nruns; i++)
+      if (runs[i][0] < runs[min][0])
+        min = i;
+
+    const c2_lptr_t *cond = index->conds[runs[min][0]];
+    if (c2_prog_run(ps, w, list->prog, cond->prog_start, true))
+      return cond;
+
+    runs[min]++;
+    if (!--lens[min]) {
+      nruns--;
+      runs[min] = runs[nruns];
+      lens[min] = lens[nruns];
+    }
+  }
+
+  return NULL;
+}
+
 /**
  * Match a window against a condition linked list.
  *
@@ -1648,6 +2505,27 @@ c2_match(session_t *ps, win *w, const c2_lptr_t *condlst,
     const c2_lptr_t **cache, void **pdata) {
   assert(w->a.map_state == XCB_MAP_STATE_VIEWABLE);
 
+  if (condlst && condlst->prog) {
+    const c2_lptr_t *matched = NULL;
+    // Check if the cached entry matches firstly
+    if (cache && *cache)
+      matched = c2_prog_run(ps, w, condlst->prog, (*cache)->prog_start, true);
+    if (!matched) {
+      if (condlst->index)
+        matched = c2_index_run(ps, w, condlst);
+      else
+        matched = c2_prog_run(ps, w, condlst->prog, 0, false);
+    }
+    if (!matched)
+      return false;
+
+    if (cache)
+      *cache = matched;
+    if (pdata)
+      *pdata = matched->data;
+    return true;
+  }
+
   // Check if the cached entry matches firstly
   if (cache && *cache && c2_match_once(ps, w, (*cache)->ptr)) {
     if (pdata)
@@ -12,6 +12,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <xcb/xproto.h>
 
 typedef struct _c2_lptr c2_lptr_t;
 typedef struct session session_t;
@@ -25,3 +26,22 @@ bool c2_match(session_t *ps, win *w, const c2_lptr_t *condlst, const c2_lptr_t *
               void **pdata);
 
 bool c2_list_postprocess(session_t *ps, c2_lptr_t *list);
+
+/// Window attributes conditions can depend on.
+enum c2_dep {
+	C2_DEP_NAME = 1 << 0,
+	C2_DEP_CLASS = 1 << 1,
+	C2_DEP_ROLE = 1 << 2,
+};
+
+bool c2_list_depends_on(const c2_lptr_t *list, unsigned deps, xcb_atom_t atom);
+
+bool c2_match_begin(session_t *ps, const win *w);
+
+void c2_match_end(session_t *ps);
+
+void c2_state_free(session_t *ps);
+
+void c2_prop_cache_invalidate(win *w, xcb_window_t wid, xcb_atom_t atom);
+
+void c2_prop_cache_clear(win *w);
@@ -104,11 +104,19 @@
 
 #define OPAQUE 0xffffffff
 #define REGISTER_PROP "_NET_WM_CM_S"
+/// Number of root window properties that could point to a pixmap of
+/// background, i.e. the length of <code>background_props_str</code>.
+#define NUM_BACKGROUND_PROPS 2
 
 #define TIME_MS_MAX LONG_MAX
 #define FADE_DELTA_TOLERANCE 0.2
 #define SWOPTI_TOLERANCE 3000
 #define WIN_GET_LEADER_MAX_RECURSION 20
+/// Maximum number of X events pulled off the connection and handled as one
+/// batch.
+#define MAX_EVENT_BATCH 256
+/// Number of buckets of the text property fetch latency histogram.
+#define TEXT_FETCH_LATENCY_BUCKETS 16
 
 #define SEC_WRAP (15L * 24L * 60L * 60L)
 
@@ -455,9 +463,64 @@ typedef struct session {
   /// Index of the next free slot in <code>expose_rects</code>.
   int n_expose;
 
+  // === Event batching statistics ===
+  /// Number of event batches handled.
+  unsigned long nevent_batches;
+  /// Number of X events received.
+  unsigned long nevents;
+  /// Number of DamageNotify events merged into a later one for the same
+  /// drawable in the same batch.
+  unsigned long ndamage_coalesced;
+  /// Number of ConfigureNotify events dropped because a later one in the
+  /// same batch superseded them.
+  unsigned long nconfigure_coalesced;
+  /// Largest number of X events handled in one batch.
+  int max_event_batch_size;
+  /// Number of times the damage region was simplified.
+  unsigned long ndamage_simplified;
+  /// Total number of rectangles of the damage region before and after
+  /// simplifying it.
+  unsigned long ndamage_rects_before, ndamage_rects_after;
+  /// Damage statistics, indexed by <code>enum damage_strategy</code>.
+  struct damage_stats {
+    /// Number of DamageNotify events handled.
+    unsigned long nevents;
+    /// Number of pixels reported damaged.
+    unsigned long long npixels_damaged;
+    /// Number of those pixels added to the screen damage, i.e. not hidden
+    /// by opaque windows above.
+    unsigned long long npixels_repainted;
+  } damage_stats[NUM_DAMAGE_STRATEGIES];
+
+  // === Condition matching ===
+  /// State shared by all condition lists, owned by c2.
+  struct c2_state *c2_state;
+  /// Number of window property lookups served from the c2 property cache.
+  unsigned long nc2_prop_cache_hits;
+  /// Number of window property lookups that had to query X.
+  unsigned long nc2_prop_cache_misses;
+#ifndef NDEBUG
+  /// Histogram of text property fetch latencies. Bucket i counts fetches
+  /// that took under 2^i microseconds but not under 2^(i-1), the last bucket
+  /// counts all slower ones.
+  unsigned long text_fetch_latency[TEXT_FETCH_LATENCY_BUCKETS];
+#endif
+
   // === Window related ===
-  /// Linked list of all windows.
+  /// Linked list of all windows, from top to bottom.
   win *list;
+  /// Bottom-most window of the window stack.
+  win *list_bottom;
+  /// Number of windows in the pending state, see <code>add_win()</code>.
+  unsigned npending_wins;
+  /// Number of windows with outstanding text property requests, see
+  /// <code>win_fetch_text_props()</code>.
+  unsigned nwins_fetching_text;
+  /// Hash table of all windows that are not destroyed, keyed by frame ID.
+  win *windows;
+  /// Hash table of all windows that are not destroyed and have a client
+  /// window, keyed by client window ID.
+  win *windows_by_client;
   /// Pointer to <code>win</code> of current active window. Used by
   /// EWMH <code>_NET_ACTIVE_WINDOW</code> focus detection. In theory,
   /// it's more reliable to store the window ID directly here, just in
@@ -471,12 +534,12 @@ typedef struct session {
   // === Shadow/dimming related ===
   /// 1x1 black Picture.
   xcb_render_picture_t black_picture;
-  /// 1x1 Picture of the shadow color.
-  xcb_render_picture_t cshadow_picture;
   /// 1x1 white Picture.
   xcb_render_picture_t white_picture;
   /// Gaussian map of shadow.
   conv *gaussian_map;
+  /// Shadow images shared between windows, owned by render.
+  struct shadow_cache *shadow_cache;
   // for shadow precomputation
   /// A region in which shadow is not painted on.
   region_t shadow_exclude_reg;
@@ -586,8 +649,13 @@ typedef struct session {
   xcb_atom_t atom_win_type;
   /// Array of atoms of all possible window types.
   xcb_atom_t atoms_wintypes[NUM_WINTYPES];
+  /// Atoms of root window properties that could point to a pixmap of
+  /// background, in the order of <code>background_props_str</code>.
+  xcb_atom_t atoms_background[NUM_BACKGROUND_PROPS];
   /// Linked list of additional atoms to track.
   latom_t *track_atom_lst;
+  /// Cache of atom names, keyed by atom. See <code>x_get_atom_name()</code>.
+  struct x_atom_name *atom_names;
 
 #ifdef CONFIG_DBUS
   // === DBus related ===
@@ -733,6 +801,16 @@ timespec_subtract(struct timespec *result,
   return x->tv_sec < y->tv_sec;
 }
 
+/**
+ * Get the time elapsed from one struct timespec to a later one, in
+ * milliseconds.
+ */
+static inline double
+timespec_ms_between(const struct timespec *start, const struct timespec *end) {
+  return (double) (end->tv_sec - start->tv_sec) * 1000.0 +
+    (double) (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
 static inline double
 get_opacity_percent(win *w) {
   return ((double) w->opacity) / OPAQUE;
@@ -799,8 +877,12 @@ die(const char *msg) {
   exit(1);
 }
 
+extern const char *background_props_str[];
+
 /**
  * Wrapper of XInternAtom() for convenience.
+ *
+ * This costs a round trip, avoid it outside of initialization.
  */
 static inline xcb_atom_t
 get_atom(session_t *ps, const char *atom_name) {
@@ -828,21 +910,16 @@ get_tgt_window(session_t *ps) {
 }
 
 /**
- * Find a window from window id in window linked list of the session.
+ * Find a window from window id in the window index of the session.
  */
 static inline win *
 find_win(session_t *ps, xcb_window_t id) {
   if (!id)
     return NULL;
 
-  win *w;
-
-  for (w = ps->list; w; w = w->next) {
-    if (w->id == id && !w->destroyed)
-      return w;
-  }
-
-  return 0;
+  win *w = NULL;
+  HASH_FIND(hh, ps->windows, &id, sizeof(id), w);
+  return w;
 }
 
 /**
@@ -856,12 +933,9 @@ find_toplevel(session_t *ps, xcb_window_t id) {
   if (!id)
     return NULL;
 
-  for (win *w = ps->list; w; w = w->next) {
-    if (w->client_win == id && !w->destroyed)
-      return w;
-  }
-
-  return NULL;
+  win *w = NULL;
+  HASH_FIND(hh_client, ps->windows_by_client, &id, sizeof(id), w);
+  return w;
 }
 
 /**
@@ -142,9 +142,17 @@ const char * const BACKEND_STRS[NUM_BKEND + 1] = {
   NULL
 };
 
+/// Names of damage strategies.
+const char * const DAMAGE_STRATEGY_STRS[NUM_DAMAGE_STRATEGIES + 1] = {
+  "rectangles",   // DAMAGE_RECTANGLES
+  "bounding-box", // DAMAGE_BOUNDING_BOX
+  "non-empty",    // DAMAGE_NON_EMPTY
+  NULL
+};
+
 /// Names of root window properties that could point to a pixmap of
 /// background.
-const char *background_props_str[] = {
+const char *background_props_str[NUM_BACKGROUND_PROPS + 1] = {
   "_XROOTPMAP_ID",
   "_XSETROOT_ID",
   0,
@@ -184,15 +192,17 @@ free_win_res(session_t *ps, win *w) {
   free_win_res_glx(ps, w);
   free_paint(ps, &w->paint);
   pixman_region32_fini(&w->bounding_shape);
-  free_paint(ps, &w->shadow_paint);
+  shadow_release(ps, &w->shadow_image);
   // BadDamage may be thrown if the window is destroyed
   set_ignore_cookie(ps,
       xcb_damage_destroy(ps->c, w->damage));
   rc_region_unref(&w->reg_ignore);
-  free(w->name);
-  free(w->class_instance);
-  free(w->class_general);
-  free(w->role);
+  c2_prop_cache_clear(w);
+  win_cancel_text_fetch(ps, w);
+  istr_unref(&w->name);
+  istr_unref(&w->class_instance);
+  istr_unref(&w->class_general);
+  istr_unref(&w->role);
 }
 
 /**
@@ -482,7 +492,7 @@ recheck_focus(session_t *ps) {
   win *w = find_win_all(ps, wid);
 
   log_trace("%#010" PRIx32 " (%#010lx \"%s\") focused.", wid,
-      (w ? w->id: XCB_NONE), (w ? w->name: NULL));
+      (w ? w->id: XCB_NONE), (w ? istr_str(w->name): NULL));
 
   // And we set the focus state here
   if (w) {
@@ -494,34 +504,86 @@ recheck_focus(session_t *ps) {
 }
 
 /**
- * Look for the client window of a particular window.
+ * Search the subtree rooted at a window for a client window, given the
+ * cookie of a pending QueryTree request on that window.
+ *
+ * The WM_STATE and QueryTree requests for all children on a level are sent
+ * before any reply is waited for, so the search costs one round trip per
+ * level of the tree instead of two per window visited. Children are still
+ * inspected in the same depth-first order as before, and replies that turn
+ * out not to be needed are discarded.
  */
-xcb_window_t
-find_client_win(session_t *ps, xcb_window_t w) {
-  if (wid_has_prop(ps, w, ps->atom_client)) {
-    return w;
-  }
-
-  xcb_query_tree_reply_t *reply = xcb_query_tree_reply(ps->c,
-      xcb_query_tree(ps->c, w), NULL);
+static xcb_window_t
+find_client_win_in_tree(session_t *ps, xcb_query_tree_cookie_t cookie) {
+  xcb_query_tree_reply_t *reply = xcb_query_tree_reply(ps->c, cookie, NULL);
   if (!reply)
     return 0;
 
   xcb_window_t *children = xcb_query_tree_children(reply);
   int nchildren = xcb_query_tree_children_length(reply);
-  int i;
   xcb_window_t ret = 0;
 
-  for (i = 0; i < nchildren; ++i) {
-    if ((ret = find_client_win(ps, children[i])))
-      break;
+  if (nchildren <= 0) {
+    free(reply);
+    return 0;
+  }
+
+  auto prop_cookies = ccalloc(nchildren, xcb_get_property_cookie_t);
+  auto tree_cookies = ccalloc(nchildren, xcb_query_tree_cookie_t);
+  for (int i = 0; i < nchildren; ++i) {
+    prop_cookies[i] = xcb_get_property(ps->c, 0, children[i], ps->atom_client,
+        XCB_GET_PROPERTY_TYPE_ANY, 0, 0);
+    tree_cookies[i] = xcb_query_tree(ps->c, children[i]);
+  }
+
+  int i = 0;
+  for (; i < nchildren && !ret; ++i) {
+    xcb_get_property_reply_t *r =
+      xcb_get_property_reply(ps->c, prop_cookies[i], NULL);
+    if (r && r->type != XCB_NONE)
+      ret = children[i];
+    free(r);
+
+    if (ret)
+      xcb_discard_reply(ps->c, tree_cookies[i].sequence);
+    else
+      ret = find_client_win_in_tree(ps, tree_cookies[i]);
   }
 
+  for (; i < nchildren; ++i) {
+    xcb_discard_reply(ps->c, prop_cookies[i].sequence);
+    xcb_discard_reply(ps->c, tree_cookies[i].sequence);
+  }
+
+  free(prop_cookies);
+  free(tree_cookies);
   free(reply);
 
   return ret;
 }
 
+/**
+ * Look for the client window of a particular window.
+ */
+xcb_window_t
+find_client_win(session_t *ps, xcb_window_t w) {
+  xcb_get_property_cookie_t prop_cookie = xcb_get_property(ps->c, 0, w,
+      ps->atom_client, XCB_GET_PROPERTY_TYPE_ANY, 0, 0);
+  xcb_query_tree_cookie_t tree_cookie = xcb_query_tree(ps->c, w);
+
+  xcb_get_property_reply_t *r =
+    xcb_get_property_reply(ps->c, prop_cookie, NULL);
+  bool is_client = r && r->type != XCB_NONE;
+  free(r);
+
+  if (is_client) {
+    xcb_discard_reply(ps->c, tree_cookie.sequence);
+    return w;
+  }
+
+  return find_client_win_in_tree(ps, tree_cookie);
+}
+
 static win *
 paint_preprocess(session_t *ps, win *list) {
   win *t = NULL, *next = NULL;
@@ -545,6 +607,14 @@ paint_preprocess(session_t *ps, win *list) {
     const winmode_t mode_old = w->mode;
     const bool was_painted = w->to_paint;
     const opacity_t opacity_old = w->opacity;
+    // Re-evaluate rules for windows whose properties changed since the
+    // last frame. Unmapped windows are re-evaluated when mapped again.
+    if (w->stale_rules) {
+      if (w->a.map_state == XCB_MAP_STATE_VIEWABLE)
+        win_update_rules(ps, w, w->stale_rules);
+      w->stale_rules = 0;
+    }
+
     // Restore flags from last paint if the window is being faded out
     if (w->a.map_state == XCB_MAP_STATE_UNMAPPED) {
       win_set_shadow(ps, w, w->shadow_last);
@@ -757,8 +827,15 @@ rebuild_shadow_exclude_reg(session_t *ps) {
     exit(1);
 }
 
+/**
+ * Handle damage to a window.
+ *
+ * @param area the area reported by DamageNotify, relative to the window. The
+ *             damaged rectangle or the bounding box of the damage, depending
+ *             on the damage strategy of the window.
+ */
 static void
-repair_win(session_t *ps, win *w) {
+repair_win(session_t *ps, win *w, const xcb_rectangle_t *area) {
   if (w->a.map_state != XCB_MAP_STATE_VIEWABLE)
     return;
 
@@ -769,7 +846,7 @@ repair_win(session_t *ps, win *w) {
     win_extents(w, &parts);
     set_ignore_cookie(ps,
         xcb_damage_subtract(ps->c, w->damage, XCB_NONE, XCB_NONE));
-  } else {
+  } else if (w->damage_strategy == DAMAGE_NON_EMPTY) {
     xcb_xfixes_region_t tmp = xcb_generate_id(ps->c);
     xcb_xfixes_create_region(ps->c, tmp, 0, NULL);
     set_ignore_cookie(ps,
@@ -779,11 +856,24 @@ repair_win(session_t *ps, win *w) {
       w->g.y + w->g.border_width);
     x_fetch_region(ps, tmp, &parts);
     xcb_xfixes_destroy_region(ps->c, tmp);
+  } else {
+    pixman_region32_union_rect(&parts, &parts,
+      w->g.x + w->g.border_width + area->x,
+      w->g.y + w->g.border_width + area->y,
+      area->width, area->height);
+    // Empty the damage, so the next change is reported again. Damage added
+    // before the server handles this has been reported already.
+    set_ignore_cookie(ps,
+        xcb_damage_subtract(ps->c, w->damage, XCB_NONE, XCB_NONE));
   }
 
   w->ever_damaged = true;
   w->pixmap_damaged = true;
 
+  struct damage_stats *stats = &ps->damage_stats[w->damage_strategy];
+  stats->nevents++;
+  stats->npixels_damaged += region_area(&parts);
+
   // Why care about damage when screen is unredirected?
   // We will force full-screen repaint on redirection.
   if (!ps->redirected) {
@@ -795,6 +885,7 @@ repair_win(session_t *ps, win *w) {
   if (w->reg_ignore && win_is_region_ignore_valid(ps, w))
     pixman_region32_subtract(&parts, &parts, w->reg_ignore);
 
+  stats->npixels_repainted += region_area(&parts);
   add_damage(ps, &parts);
   pixman_region32_fini(&parts);
 }
@@ -819,7 +910,7 @@ map_win(session_t *ps, xcb_window_t id) {
 
   win *w = find_win(ps, id);
 
-  log_trace("(%#010x \"%s\"): %p", id, (w ? w->name: NULL), w);
+  log_trace("(%#010x \"%s\"): %p", id, (w ? istr_str(w->name): NULL), w);
 
   // Don't care about window mapping if it's an InputOnly window
   // Try avoiding mapping a window twice
@@ -846,6 +937,9 @@ map_win(session_t *ps, xcb_window_t id) {
   // Make sure the XSelectInput() requests are sent
   XFlush(ps->dpy);
 
+  // Property changes while the window was unmapped went unnoticed
+  c2_prop_cache_clear(w);
+
   // Update window mode here to check for ARGB windows
   win_determine_mode(ps, w);
 
@@ -922,7 +1016,7 @@ finish_unmap_win(session_t *ps, win **_w) {
   add_damage_from_win(ps, w);
 
   free_paint(ps, &w->paint);
-  free_paint(ps, &w->shadow_paint);
+  shadow_release(ps, &w->shadow_image);
 }
 
 static void
@@ -976,34 +1070,20 @@ restack_win(session_t *ps, win *w, xcb_window_t new_above) {
       rc_region_unref(&w->next->reg_ignore);
     }
 
-    win **prev = NULL, **prev_old = NULL;
-
-    // unhook
-    for (prev = &ps->list; *prev; prev = &(*prev)->next) {
-      if ((*prev) == w) break;
-    }
-
-    prev_old = prev;
-
-    bool found = false;
-
-    // rehook
-    for (prev = &ps->list; *prev; prev = &(*prev)->next) {
-      if ((*prev)->id == new_above && !(*prev)->destroyed) {
-        found = true;
-        break;
+    win *below = NULL;
+    if (new_above) {
+      below = find_win(ps, new_above);
+      if (!below) {
+        log_error("(%#010x, %#010x): Failed to found new above window.", w->id, new_above);
+        return;
       }
+      // Restacking a window above itself is a no-op
+      if (below == w)
+        return;
     }
 
-    if (new_above && !found) {
-      log_error("(%#010x, %#010x): Failed to found new above window.", w->id, new_above);
-      return;
-    }
-
-    *prev_old = w->next;
-
-    w->next = *prev;
-    *prev = w;
+    win_stack_remove(ps, w);
+    win_stack_insert(ps, w, below);
 
     // add damage for this window
     add_damage_from_win(ps, w);
@@ -1165,45 +1245,40 @@ static void
 finish_destroy_win(session_t *ps, win **_w) {
   win *w = *_w;
   assert(w->destroyed);
-  win **prev = NULL, *i = NULL;
 
-  log_trace("(%#010x): Starting...", w->id);
+  log_trace("(%#010x \"%s\"): %p", w->id, istr_str(w->name), w);
 
-  for (prev = &ps->list; (i = *prev); prev = &i->next) {
-    if (w == i) {
-      log_trace("(%#010x \"%s\"): %p", w->id, w->name, w);
+  finish_unmap_win(ps, _w);
+  win_stack_remove(ps, w);
 
-      finish_unmap_win(ps, _w);
-      *prev = w->next;
+  // Clear active_win if it's pointing to the destroyed window
+  if (w == ps->active_win)
+    ps->active_win = NULL;
 
-      // Clear active_win if it's pointing to the destroyed window
-      if (w == ps->active_win)
-        ps->active_win = NULL;
+  free_win_res(ps, w);
 
-      free_win_res(ps, w);
+  // Drop w from all prev_trans to avoid accessing freed memory in
+  // repair_win()
+  for (win *w2 = ps->list; w2; w2 = w2->next)
+    if (w == w2->prev_trans)
+      w2->prev_trans = NULL;
 
-      // Drop w from all prev_trans to avoid accessing freed memory in
-      // repair_win()
-      for (win *w2 = ps->list; w2; w2 = w2->next)
-        if (w == w2->prev_trans)
-          w2->prev_trans = NULL;
-
-      free(w);
-      *_w = NULL;
-      break;
-    }
-  }
+  free(w);
+  *_w = NULL;
 }
 
 static void
 destroy_win(session_t *ps, xcb_window_t id) {
   win *w = find_win(ps, id);
 
-  log_trace("(%#010x \"%s\"): %p", id, (w ? w->name: NULL), w);
+  log_trace("(%#010x \"%s\"): %p", id, (w ? istr_str(w->name): NULL), w);
 
   if (w) {
     unmap_win(ps, &w);
 
+    // Destroyed windows linger in the stack for fading, but must not be
+    // found by ID anymore
+    win_unindex(ps, w);
     w->destroyed = true;
 
     if (ps->o.no_fading_destroyed_argb)
@@ -1649,12 +1724,8 @@ ev_property_notify(session_t *ps, xcb_property_notify_event_t *ev) {
     }
     else {
       // Destroy the root "image" if the wallpaper probably changed
-      for (int p = 0; background_props_str[p]; p++) {
-        if (ev->atom == get_atom(ps, background_props_str[p])) {
-          root_damaged(ps);
-          break;
-        }
-      }
+      if (x_atom_is_background_prop(ps, ev->atom))
+        root_damaged(ps);
     }
 
     // Unconcerned about any other proprties on root window
@@ -1711,26 +1782,22 @@ ev_property_notify(session_t *ps, xcb_property_notify_event_t *ev) {
   if (ps->o.track_wdata
       && (ps->atom_name == ev->atom || ps->atom_name_ewmh == ev->atom)) {
     win *w = find_toplevel(ps, ev->window);
-    if (w && 1 == win_get_name(ps, w)) {
-      win_on_factor_change(ps, w);
-    }
+    if (w)
+      win_fetch_text_props(ps, w, 1u << WIN_TEXT_NAME);
   }
 
   // If class changes
   if (ps->o.track_wdata && ps->atom_class == ev->atom) {
     win *w = find_toplevel(ps, ev->window);
-    if (w) {
-      win_get_class(ps, w);
-      win_on_factor_change(ps, w);
-    }
+    if (w)
+      win_fetch_text_props(ps, w, 1u << WIN_TEXT_CLASS);
   }
 
   // If role changes
   if (ps->o.track_wdata && ps->atom_role == ev->atom) {
     win *w = find_toplevel(ps, ev->window);
-    if (w && 1 == win_get_role(ps, w)) {
-      win_on_factor_change(ps, w);
-    }
+    if (w)
+      win_fetch_text_props(ps, w, 1u << WIN_TEXT_ROLE);
   }
 
   // If _COMPTON_SHADOW changes
@@ -1755,8 +1822,10 @@ ev_property_notify(session_t *ps, xcb_property_notify_event_t *ev) {
       win *w = find_win(ps, ev->window);
       if (!w)
         w = find_toplevel(ps, ev->window);
-      if (w)
-        win_on_factor_change(ps, w);
+      if (w) {
+        c2_prop_cache_invalidate(w, ev->window, ev->atom);
+        win_mark_factor_change(ps, w, 0, ev->atom);
+      }
       break;
     }
   }
@@ -1774,7 +1843,7 @@ ev_damage_notify(session_t *ps, xcb_damage_notify_event_t *de) {
 
   if (!w) return;
 
-  repair_win(ps, w);
+  repair_win(ps, w, &de->area);
 }
 
 inline static void
@@ -1846,10 +1915,12 @@ ev_window_name(session_t *ps, xcb_window_t wid, char **name) {
       if (!w)
         w = find_toplevel(ps, wid);
 
-      if (w)
-        win_get_name(ps, w);
+      if (w) {
+        win_fetch_text_props(ps, w, 1u << WIN_TEXT_NAME);
+        win_mark_factor_change(ps, w, win_finish_text_fetch(ps, w), XCB_NONE);
+      }
       if (w && w->name)
-        *name = w->name;
+        *name = w->name->str;
       else
         *name = "unknown";
     }
@@ -1900,6 +1971,12 @@ ev_handle(session_t *ps, xcb_generic_event_t *ev) {
   // XXX redraw needs to be more fine grained
   queue_redraw(ps);
 
+  // Finish adding the window this event is about first, so the event is
+  // never applied to a pending window
+  win *pw = find_win(ps, ev_window(ps, ev));
+  if (pw && pw->pending)
+    win_finish_add(ps, &pw);
+
   switch (ev->response_type) {
     case FocusIn:
       ev_focus_in(ps, (xcb_focus_in_event_t *)ev);
@@ -2100,51 +2177,61 @@ write_pid(session_t *ps) {
 
 /**
  * Fetch all required atoms and save them to a session.
+ *
+ * All InternAtom requests are sent before any reply is waited for, so this
+ * costs a single round trip.
  */
 static void
 init_atoms(session_t *ps) {
-  ps->atom_opacity = get_atom(ps, "_NET_WM_WINDOW_OPACITY");
-  ps->atom_frame_extents = get_atom(ps, "_NET_FRAME_EXTENTS");
-  ps->atom_client = get_atom(ps, "WM_STATE");
   ps->atom_name = XCB_ATOM_WM_NAME;
-  ps->atom_name_ewmh = get_atom(ps, "_NET_WM_NAME");
   ps->atom_class = XCB_ATOM_WM_CLASS;
-  ps->atom_role = get_atom(ps, "WM_WINDOW_ROLE");
   ps->atom_transient = XCB_ATOM_WM_TRANSIENT_FOR;
-  ps->atom_client_leader = get_atom(ps, "WM_CLIENT_LEADER");
-  ps->atom_ewmh_active_win = get_atom(ps, "_NET_ACTIVE_WINDOW");
-  ps->atom_compton_shadow = get_atom(ps, "_COMPTON_SHADOW");
-
-  ps->atom_win_type = get_atom(ps, "_NET_WM_WINDOW_TYPE");
   ps->atoms_wintypes[WINTYPE_UNKNOWN] = 0;
-  ps->atoms_wintypes[WINTYPE_DESKTOP] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DESKTOP");
-  ps->atoms_wintypes[WINTYPE_DOCK] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DOCK");
-  ps->atoms_wintypes[WINTYPE_TOOLBAR] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_TOOLBAR");
-  ps->atoms_wintypes[WINTYPE_MENU] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_MENU");
-  ps->atoms_wintypes[WINTYPE_UTILITY] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_UTILITY");
-  ps->atoms_wintypes[WINTYPE_SPLASH] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_SPLASH");
-  ps->atoms_wintypes[WINTYPE_DIALOG] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DIALOG");
-  ps->atoms_wintypes[WINTYPE_NORMAL] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_NORMAL");
-  ps->atoms_wintypes[WINTYPE_DROPDOWN_MENU] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU");
-  ps->atoms_wintypes[WINTYPE_POPUP_MENU] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_POPUP_MENU");
-  ps->atoms_wintypes[WINTYPE_TOOLTIP] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_TOOLTIP");
-  ps->atoms_wintypes[WINTYPE_NOTIFY] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_NOTIFICATION");
-  ps->atoms_wintypes[WINTYPE_COMBO] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_COMBO");
-  ps->atoms_wintypes[WINTYPE_DND] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DND");
+
+  const struct {
+    const char *name;
+    xcb_atom_t *atom;
+  } atoms[] = {
+    { "_NET_WM_WINDOW_OPACITY", &ps->atom_opacity },
+    { "_NET_FRAME_EXTENTS", &ps->atom_frame_extents },
+    { "WM_STATE", &ps->atom_client },
+    { "_NET_WM_NAME", &ps->atom_name_ewmh },
+    { "WM_WINDOW_ROLE", &ps->atom_role },
+    { "WM_CLIENT_LEADER", &ps->atom_client_leader },
+    { "_NET_ACTIVE_WINDOW", &ps->atom_ewmh_active_win },
+    { "_COMPTON_SHADOW", &ps->atom_compton_shadow },
+    { "_NET_WM_WINDOW_TYPE", &ps->atom_win_type },
+    { "_NET_WM_WINDOW_TYPE_DESKTOP", &ps->atoms_wintypes[WINTYPE_DESKTOP] },
+    { "_NET_WM_WINDOW_TYPE_DOCK", &ps->atoms_wintypes[WINTYPE_DOCK] },
+    { "_NET_WM_WINDOW_TYPE_TOOLBAR", &ps->atoms_wintypes[WINTYPE_TOOLBAR] },
+    { "_NET_WM_WINDOW_TYPE_MENU", &ps->atoms_wintypes[WINTYPE_MENU] },
+    { "_NET_WM_WINDOW_TYPE_UTILITY", &ps->atoms_wintypes[WINTYPE_UTILITY] },
+    { "_NET_WM_WINDOW_TYPE_SPLASH", &ps->atoms_wintypes[WINTYPE_SPLASH] },
+    { "_NET_WM_WINDOW_TYPE_DIALOG", &ps->atoms_wintypes[WINTYPE_DIALOG] },
+    { "_NET_WM_WINDOW_TYPE_NORMAL", &ps->atoms_wintypes[WINTYPE_NORMAL] },
+    { "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU",
+      &ps->atoms_wintypes[WINTYPE_DROPDOWN_MENU] },
+    { "_NET_WM_WINDOW_TYPE_POPUP_MENU", &ps->atoms_wintypes[WINTYPE_POPUP_MENU] },
+    { "_NET_WM_WINDOW_TYPE_TOOLTIP", &ps->atoms_wintypes[WINTYPE_TOOLTIP] },
+    { "_NET_WM_WINDOW_TYPE_NOTIFICATION", &ps->atoms_wintypes[WINTYPE_NOTIFY] },
+    { "_NET_WM_WINDOW_TYPE_COMBO", &ps->atoms_wintypes[WINTYPE_COMBO] },
+    { "_NET_WM_WINDOW_TYPE_DND", &ps->atoms_wintypes[WINTYPE_DND] },
+    { background_props_str[0], &ps->atoms_background[0] },
+    { background_props_str[1], &ps->atoms_background[1] },
+  };
+  xcb_intern_atom_cookie_t cookies[ARR_SIZE(atoms)];
+  for (size_t i = 0; i < ARR_SIZE(atoms); i++)
+    cookies[i] = xcb_intern_atom(ps->c, 0, strlen(atoms[i].name), atoms[i].name);
+
+  for (size_t i = 0; i < ARR_SIZE(atoms); i++) {
+    xcb_intern_atom_reply_t *reply =
+      xcb_intern_atom_reply(ps->c, cookies[i], NULL);
+    if (!reply)
+      die("Failed to intern atoms, bail out");
+    log_debug("Atom %s is %d", atoms[i].name, reply->atom);
+    *atoms[i].atom = reply->atom;
+    free(reply);
+  }
 }
 
 /**
@@ -2331,15 +2418,154 @@ redir_stop(session_t *ps) {
   }
 }
 
+/**
+ * Check if an event can be moved past window <code>wid</code> being
+ * configured, or being damaged, without changing the outcome of either.
+ *
+ * DamageNotify events can always be reordered. Their area is relative to
+ * the window and is translated with its geometry when handled, so it may
+ * land at a stale position if moved past a ConfigureNotify. That is harmless:
+ * configure_win() damages both the old and the new extents whenever the
+ * geometry changes, and if the geometry ends up unchanged, the position is
+ * the same either way. ConfigureNotify events of other windows can be
+ * reordered as long as they don't restack relative to <code>wid</code>.
+ */
+static inline bool
+x_event_independent_of(session_t *ps, xcb_generic_event_t *ev, xcb_window_t wid) {
+  if (ev->response_type == ps->damage_event + XCB_DAMAGE_NOTIFY)
+    return true;
+  if (ev->response_type == XCB_CONFIGURE_NOTIFY) {
+    auto ce = (xcb_configure_notify_event_t *)ev;
+    return ce->window != wid && ce->above_sibling != wid;
+  }
+  return false;
+}
+
+/**
+ * Drop events in a batch that are made redundant by another event in the
+ * same batch. Dropped events are freed and their slots set to NULL.
+ */
+static void
+coalesce_x_events(session_t *ps, xcb_generic_event_t **evs, int nevs) {
+  const uint8_t damage_notify = ps->damage_event + XCB_DAMAGE_NOTIFY;
+  for (int i = 1; i < nevs; i++) {
+    if (evs[i]->response_type == damage_notify) {
+      auto de = (xcb_damage_notify_event_t *)evs[i];
+      win *w = find_win(ps, de->drawable);
+      // Merging rectangles would defeat the point of reporting them one by
+      // one
+      if (!w || w->damage_strategy == DAMAGE_RECTANGLES)
+        continue;
+      for (int j = i - 1; j >= 0; j--) {
+        if (!evs[j])
+          continue;
+        if (evs[j]->response_type == damage_notify &&
+            ((xcb_damage_notify_event_t *)evs[j])->drawable == de->drawable &&
+            w->damage_strategy == DAMAGE_NON_EMPTY) {
+          // Handling one DamageNotify fetches all damage the drawable has
+          // accumulated, so a following one carries nothing new.
+          free(evs[i]);
+          evs[i] = NULL;
+          ps->ndamage_coalesced++;
+          break;
+        }
+        if (evs[j]->response_type == damage_notify &&
+            ((xcb_damage_notify_event_t *)evs[j])->drawable == de->drawable) {
+          // DamageNotify carries the bounding box of the damage, so an
+          // earlier one can be folded into it.
+          const xcb_rectangle_t *a = &((xcb_damage_notify_event_t *)evs[j])->area;
+          xcb_rectangle_t *b = &de->area;
+          int x2 = max_i(a->x + a->width, b->x + b->width);
+          int y2 = max_i(a->y + a->height, b->y + b->height);
+          b->x = min_i(a->x, b->x);
+          b->y = min_i(a->y, b->y);
+          b->width = (uint16_t)(x2 - b->x);
+          b->height = (uint16_t)(y2 - b->y);
+          free(evs[j]);
+          evs[j] = NULL;
+          ps->ndamage_coalesced++;
+          break;
+        }
+        if (!x_event_independent_of(ps, evs[j], de->drawable))
+          break;
+      }
+    } else if (evs[i]->response_type == XCB_CONFIGURE_NOTIFY) {
+      // A ConfigureNotify carries the complete geometry and stacking of a
+      // window, so it supersedes an earlier one for the same window, as
+      // long as nothing in between depends on the earlier state.
+      auto ce = (xcb_configure_notify_event_t *)evs[i];
+      for (int j = i - 1; j >= 0; j--) {
+        if (!evs[j])
+          continue;
+        if (evs[j]->response_type == XCB_CONFIGURE_NOTIFY &&
+            ((xcb_configure_notify_event_t *)evs[j])->window == ce->window) {
+          free(evs[j]);
+          evs[j] = NULL;
+          ps->nconfigure_coalesced++;
+          break;
+        }
+        if (!x_event_independent_of(ps, evs[j], ce->window))
+          break;
+      }
+    }
+  }
+}
+
+/**
+ * Handle all X events already read from the X connection, in batches of at
+ * most <code>MAX_EVENT_BATCH</code> events.
+ *
+ * @param ev an event to handle before the queued ones, or NULL
+ */
+static void
+handle_x_events(session_t *ps, xcb_generic_event_t *ev) {
+  xcb_generic_event_t *evs[MAX_EVENT_BATCH];
+  int nevs = 0;
+
+  if (ev)
+    evs[nevs++] = ev;
+
+  while (true) {
+    while (nevs < MAX_EVENT_BATCH && (ev = xcb_poll_for_queued_event(ps->c)))
+      evs[nevs++] = ev;
+
+    if (nevs) {
+      ps->nevent_batches++;
+      ps->nevents += nevs;
+      ps->max_event_batch_size = max_i(ps->max_event_batch_size, nevs);
+
+      coalesce_x_events(ps, evs, nevs);
+      for (int i = 0; i < nevs; i++) {
+        if (evs[i]) {
+          ev_handle(ps, evs[i]);
+          free(evs[i]);
+        }
+      }
+      nevs = 0;
+    }
+
+    // Polling for replies reads the X connection, and finishing windows
+    // sends synchronous requests, both of which can queue more events.
+    // Nothing would wake us up for events already read, so keep going
+    // until there are neither events nor replies left to handle.
+    bool progress = false;
+    if (ps->npending_wins)
+      progress = win_poll_pending(ps);
+    if (ps->nwins_fetching_text)
+      progress = win_poll_text_props(ps) || progress;
+    if (progress)
+      continue;
+    if (!(ev = xcb_poll_for_queued_event(ps->c)))
+      break;
+    evs[nevs++] = ev;
+  }
+}
+
 // Handle queued events before we go to sleep
 static void
 handle_queued_x_events(EV_P_ ev_prepare *w, int revents) {
   session_t *ps = session_ptr(w, event_check);
-  xcb_generic_event_t *ev;
-  while ((ev = xcb_poll_for_queued_event(ps->c))) {
-    ev_handle(ps, ev);
-    free(ev);
-  };
+  handle_x_events(ps, NULL);
   XFlush(ps->dpy);
   xcb_flush(ps->c);
 
@@ -2467,11 +2693,10 @@ delayed_draw_callback(EV_P_ ev_idle *w, int revents) {
 static void
 x_event_callback(EV_P_ ev_io *w, int revents) {
   session_t *ps = (session_t *)w;
-  xcb_generic_event_t *ev = xcb_poll_for_event(ps->c);
-  if (ev) {
-    ev_handle(ps, ev);
-    free(ev);
-  }
+  // Read everything available on the connection, and handle it in one go.
+  // We might have been woken up by replies only, which are handled there
+  // too.
+  handle_x_events(ps, xcb_poll_for_event(ps->c));
 }
 
 /**
@@ -2546,6 +2771,8 @@ session_init(session_t *ps_old, int argc, char **argv) {
       .shadow_offset_x = -15,
       .shadow_offset_y = -15,
       .shadow_opacity = .75,
+      .shadow_cache_size = 81920,
+      .shadow_nine_slice = false,
       .shadow_blacklist = NULL,
       .shadow_ignore_shaped = false,
       .respect_prop_shadow = false,
@@ -2573,6 +2800,10 @@ session_init(session_t *ps_old, int argc, char **argv) {
       .inactive_dim_fixed = false,
       .invert_color_list = NULL,
       .opacity_rules = NULL,
+      .damage_max_rects = 64,
+      .damage_overdraw = 0.25,
+      .damage_strategy = DAMAGE_BOUNDING_BOX,
+      .damage_strategy_rules = NULL,
 
       .use_ewmh_active_win = false,
       .focus_blacklist = NULL,
@@ -2597,12 +2828,28 @@ session_init(session_t *ps_old, int argc, char **argv) {
     .size_expose = 0,
     .n_expose = 0,
 
+    .nevent_batches = 0,
+    .nevents = 0,
+    .ndamage_coalesced = 0,
+    .ndamage_simplified = 0,
+    .ndamage_rects_before = 0,
+    .ndamage_rects_after = 0,
+    .nconfigure_coalesced = 0,
+    .max_event_batch_size = 0,
+    .c2_state = NULL,
+    .nc2_prop_cache_hits = 0,
+    .nc2_prop_cache_misses = 0,
+
     .list = NULL,
+    .list_bottom = NULL,
+    .npending_wins = 0,
+    .nwins_fetching_text = 0,
+    .windows = NULL,
+    .windows_by_client = NULL,
     .active_win = NULL,
     .active_leader = XCB_NONE,
 
     .black_picture = XCB_NONE,
-    .cshadow_picture = XCB_NONE,
     .white_picture = XCB_NONE,
     .gaussian_map = NULL,
 
@@ -2650,6 +2897,7 @@ session_init(session_t *ps_old, int argc, char **argv) {
     .atom_win_type = XCB_NONE,
     .atoms_wintypes = { 0 },
     .track_atom_lst = NULL,
+    .atom_names = NULL,
 
 #ifdef CONFIG_DBUS
     .dbus_data = NULL,
@@ -2808,6 +3056,7 @@ session_init(session_t *ps_old, int argc, char **argv) {
         c2_list_postprocess(ps, ps->o.blur_background_blacklist) &&
         c2_list_postprocess(ps, ps->o.invert_color_list) &&
         c2_list_postprocess(ps, ps->o.opacity_rules) &&
+        c2_list_postprocess(ps, ps->o.damage_strategy_rules) &&
         c2_list_postprocess(ps, ps->o.focus_blacklist))) {
     log_error("Post-processing of conditionals failed, some of your rules might not work");
   }
@@ -3008,9 +3257,11 @@ session_init(session_t *ps_old, int argc, char **argv) {
   {
     xcb_window_t *children;
     int nchildren;
+    struct timespec t_start = get_time_timespec();
 
     xcb_query_tree_reply_t *reply = xcb_query_tree_reply(ps->c,
         xcb_query_tree(ps->c, ps->root), NULL);
+    struct timespec t_tree = get_time_timespec();
 
     if (reply) {
       children = xcb_query_tree_children(reply);
@@ -3023,6 +3274,32 @@ session_init(session_t *ps_old, int argc, char **argv) {
     for (int i = 0; i < nchildren; i++) {
       add_win(ps, children[i], i ? children[i-1] : XCB_NONE);
     }
+    xcb_flush(ps->c);
+    struct timespec t_sent = get_time_timespec();
+
+    // All requests are out, now collect the replies, bottom to top
+    for (win *w = ps->list_bottom, *prev; w; w = prev) {
+      prev = w->prev;
+      if (w->pending)
+        win_finish_add(ps, &w);
+    }
+    struct timespec t_done = get_time_timespec();
+
+    if (ps->o.startup_timing) {
+      unsigned nwins = 0, nmapped = 0;
+      for (win *w = ps->list; w; w = w->next) {
+        nwins++;
+        if (w->a.map_state == XCB_MAP_STATE_VIEWABLE)
+          nmapped++;
+      }
+      printf("Startup scan: %d top-level windows, %u managed, %u mapped\n",
+          nchildren, nwins, nmapped);
+      printf("  query tree:      %8.3f ms\n", timespec_ms_between(&t_start, &t_tree));
+      printf("  send requests:   %8.3f ms\n", timespec_ms_between(&t_tree, &t_sent));
+      printf("  collect replies: %8.3f ms\n", timespec_ms_between(&t_sent, &t_done));
+      printf("  total:           %8.3f ms\n", timespec_ms_between(&t_start, &t_done));
+      fflush(stdout);
+    }
 
     free(reply);
   }
@@ -3070,6 +3347,41 @@ session_init(session_t *ps_old, int argc, char **argv) {
  */
 static void
 session_destroy(session_t *ps) {
+  if (ps->nevent_batches)
+    log_debug("Handled %lu X events in %lu batches, %.1f events per batch on "
+              "average, %d at most. Coalesced %lu DamageNotify and %lu "
+              "ConfigureNotify events.", ps->nevents, ps->nevent_batches,
+              (double)ps->nevents / ps->nevent_batches,
+              ps->max_event_batch_size, ps->ndamage_coalesced,
+              ps->nconfigure_coalesced);
+  if (ps->nc2_prop_cache_hits || ps->nc2_prop_cache_misses)
+    log_debug("Condition property cache: %lu hits, %lu misses.",
+              ps->nc2_prop_cache_hits, ps->nc2_prop_cache_misses);
+  if (ps->ndamage_simplified)
+    log_debug("Simplified the damage region %lu times, from %.1f to %.1f "
+              "rectangles on average.", ps->ndamage_simplified,
+              (double)ps->ndamage_rects_before / ps->ndamage_simplified,
+              (double)ps->ndamage_rects_after / ps->ndamage_simplified);
+  for (int i = 0; i < NUM_DAMAGE_STRATEGIES; i++) {
+    const struct damage_stats *stats = &ps->damage_stats[i];
+    if (stats->nevents)
+      log_debug("Damage strategy %s: %lu events, %llu pixels damaged, %llu "
+                "repainted.", DAMAGE_STRATEGY_STRS[i], stats->nevents,
+                stats->npixels_damaged, stats->npixels_repainted);
+  }
+#ifndef NDEBUG
+  for (int i = 0; i < TEXT_FETCH_LATENCY_BUCKETS; i++) {
+    if (!ps->text_fetch_latency[i])
+      continue;
+    if (i < TEXT_FETCH_LATENCY_BUCKETS - 1)
+      log_debug("Text property fetches under %d us: %lu", 1 << i,
+                ps->text_fetch_latency[i]);
+    else
+      log_debug("Text property fetches over %d us: %lu", 1 << (i - 1),
+                ps->text_fetch_latency[i]);
+  }
+#endif
+
   redir_stop(ps);
 
   // Stop listening to events on root window
@@ -3086,6 +3398,9 @@ session_destroy(session_t *ps) {
 
   // Free window linked list
   {
+    HASH_CLEAR(hh, ps->windows);
+    HASH_CLEAR(hh_client, ps->windows_by_client);
+
     win *next = NULL;
     for (win *w = ps->list; w; w = next) {
       // Must be put here to avoid segfault
@@ -3094,11 +3409,22 @@ session_destroy(session_t *ps) {
       if (w->a.map_state == XCB_MAP_STATE_VIEWABLE && !w->destroyed)
         win_ev_stop(ps, w);
 
+      if (w->pending) {
+        // Nobody is going to collect these replies
+        xcb_discard_reply(ps->c, w->pending_attr.sequence);
+        xcb_discard_reply(ps->c, w->pending_geom.sequence);
+        if (ps->shape_exists) {
+          xcb_discard_reply(ps->c, w->pending_shape.sequence);
+          xcb_discard_reply(ps->c, w->pending_shape_rects.sequence);
+        }
+      }
+
       free_win_res(ps, w);
       free(w);
     }
 
     ps->list = NULL;
+    ps->list_bottom = NULL;
   }
 
   // Free blacklists
@@ -3108,8 +3434,10 @@ session_destroy(session_t *ps) {
   free_wincondlst(&ps->o.invert_color_list);
   free_wincondlst(&ps->o.blur_background_blacklist);
   free_wincondlst(&ps->o.opacity_rules);
+  free_wincondlst(&ps->o.damage_strategy_rules);
   free_wincondlst(&ps->o.paint_blacklist);
   free_wincondlst(&ps->o.unredir_if_possible_blacklist);
+  c2_state_free(ps);
 
   // Free tracked atom list
   {
@@ -3122,6 +3450,9 @@ session_destroy(session_t *ps) {
     ps->track_atom_lst = NULL;
   }
 
+  // Free atom name cache
+  x_free_atom_names(ps);
+
   // Free ignore linked list
   {
     ignore_t *next = NULL;
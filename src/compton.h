@@ -42,6 +42,8 @@ win *find_toplevel2(session_t *ps, xcb_window_t wid);
 
 void map_win(session_t *ps, xcb_window_t id);
 
+void queue_redraw(session_t *ps);
+
 /**
  * Subtract two unsigned long values.
  *
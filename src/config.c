@@ -343,6 +343,30 @@ bool parse_rule_opacity(c2_lptr_t **res, const char *src) {
   return c2_parse(res, endptr, (void *) val);
 }
 
+/**
+ * Parse a damage strategy rule, in the format "STRATEGY:PATTERN".
+ */
+bool parse_rule_damage_strategy(c2_lptr_t **res, const char *src) {
+  src = skip_space(src);
+  const char *sep = strchr(src, ':');
+  if (!sep) {
+    log_error("Damage strategy terminator not found: %s", src);
+    return false;
+  }
+
+  size_t len = sep - src;
+  while (len && isspace(src[len - 1]))
+    --len;
+  char *name = strndup(src, len);
+  enum damage_strategy val = parse_damage_strategy(name);
+  free(name);
+  if (val >= NUM_DAMAGE_STRATEGIES)
+    return false;
+
+  // Store the strategy plus one, so it is never NULL
+  return c2_parse(res, sep + 1, (void *)(intptr_t)(val + 1));
+}
+
 /**
  * Add a pattern to a condition linked list.
  */
@@ -77,6 +77,8 @@ typedef struct options_t {
 	// === Debugging ===
 	bool monitor_repaint;
 	bool print_diagnostics;
+	/// Whether to report how long the startup scan of existing windows took.
+	bool startup_timing;
 	// === General ===
 	/// The configuration file we used.
 	char *config_file;
@@ -106,6 +108,16 @@ typedef struct options_t {
 	bool force_win_blend;
 	/// Resize damage for a specific number of pixels.
 	int resize_damage;
+	/// Number of rectangles above which damage regions are simplified, 0 to
+	/// never simplify them.
+	int damage_max_rects;
+	/// How much area simplifying a damage region may add, as a fraction of
+	/// its area.
+	double damage_overdraw;
+	/// How to find out which parts of windows are damaged.
+	enum damage_strategy damage_strategy;
+	/// Rules to change the damage strategy of windows.
+	c2_lptr_t *damage_strategy_rules;
 	/// Whether to unredirect all windows if a full-screen opaque window
 	/// is detected.
 	bool unredir_if_possible;
@@ -168,6 +180,11 @@ typedef struct options_t {
 	bool respect_prop_shadow;
 	/// Whether to crop shadow to the very Xinerama screen.
 	bool xinerama_shadow_crop;
+	/// How much memory shadow images no window uses may keep, in KiB.
+	int shadow_cache_size;
+	/// Whether to paint shadows of large enough windows from nine-slice
+	/// tiles shared by all windows.
+	bool shadow_nine_slice;
 
 	// === Fading ===
 	/// How much to fade in in a single fading step.
@@ -248,6 +265,7 @@ typedef struct options_t {
 
 extern const char *const VSYNC_STRS[NUM_VSYNC + 1];
 extern const char *const BACKEND_STRS[NUM_BKEND + 1];
+extern const char *const DAMAGE_STRATEGY_STRS[NUM_DAMAGE_STRATEGIES + 1];
 
 attr_warn_unused_result bool parse_long(const char *, long *);
 attr_warn_unused_result const char *parse_matrix_readnum(const char *, double *);
@@ -259,6 +277,7 @@ attr_warn_unused_result bool
 parse_conv_kern_lst(const char *, xcb_render_fixed_t **, int, bool *hasneg);
 attr_warn_unused_result bool parse_geometry(session_t *, const char *, region_t *);
 attr_warn_unused_result bool parse_rule_opacity(c2_lptr_t **, const char *);
+attr_warn_unused_result bool parse_rule_damage_strategy(c2_lptr_t **, const char *);
 
 /**
  * Add a pattern to a condition linked list.
@@ -370,4 +389,17 @@ static inline vsync_t parse_vsync(const char *str) {
 	return NUM_VSYNC;
 }
 
+/**
+ * Parse a damage strategy option argument.
+ */
+static inline enum damage_strategy parse_damage_strategy(const char *str) {
+	for (enum damage_strategy i = 0; DAMAGE_STRATEGY_STRS[i]; ++i)
+		if (!strcasecmp(str, DAMAGE_STRATEGY_STRS[i])) {
+			return i;
+		}
+
+	log_error("Invalid damage strategy argument: %s", str);
+	return NUM_DAMAGE_STRATEGIES;
+}
+
 // vim: set noet sw=8 ts=8 :
@@ -134,23 +134,26 @@ parse_cfg_condlst(const config_t *pcfg, c2_lptr_t **pcondlst,
 }
 
 /**
- * Parse an opacity rule list in configuration file.
+ * Parse a list of rules with values, like opacity rules, in configuration
+ * file.
+ *
+ * @param parse function parsing one rule into the list
  */
 static inline void
-parse_cfg_condlst_opct(options_t *opt, const config_t *pcfg, const char *name) {
+parse_cfg_condlst_rule(const config_t *pcfg, c2_lptr_t **pcondlst, const char *name,
+                       bool (*parse)(c2_lptr_t **, const char *)) {
   config_setting_t *setting = config_lookup(pcfg, name);
   if (setting) {
     // Parse an array of options
     if (config_setting_is_array(setting)) {
       int i = config_setting_length(setting);
       while (i--)
-        if (!parse_rule_opacity(&opt->opacity_rules,
-                                config_setting_get_string_elem(setting, i)))
+        if (!parse(pcondlst, config_setting_get_string_elem(setting, i)))
           exit(1);
     }
     // Treat it as a single pattern if it's a string
     else if (config_setting_type(setting) == CONFIG_TYPE_STRING) {
-      if (!parse_rule_opacity(&opt->opacity_rules, config_setting_get_string(setting)))
+      if (!parse(pcondlst, config_setting_get_string(setting)))
         exit(1);
     }
   }
@@ -295,6 +298,10 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
   // --shadow-ignore-shaped
   lcfg_lookup_bool(&cfg, "shadow-ignore-shaped",
       &opt->shadow_ignore_shaped);
+  // --shadow-cache-size
+  config_lookup_int(&cfg, "shadow-cache-size", &opt->shadow_cache_size);
+  // --shadow-nine-slice
+  lcfg_lookup_bool(&cfg, "shadow-nine-slice", &opt->shadow_nine_slice);
   // --detect-rounded-corners
   lcfg_lookup_bool(&cfg, "detect-rounded-corners",
       &opt->detect_rounded_corners);
@@ -367,7 +374,8 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
   // --blur-background-exclude
   parse_cfg_condlst(&cfg, &opt->blur_background_blacklist, "blur-background-exclude");
   // --opacity-rule
-  parse_cfg_condlst_opct(opt, &cfg, "opacity-rule");
+  parse_cfg_condlst_rule(&cfg, &opt->opacity_rules, "opacity-rule",
+      parse_rule_opacity);
   // --unredir-if-possible-exclude
   parse_cfg_condlst(&cfg, &opt->unredir_if_possible_blacklist, "unredir-if-possible-exclude");
   // --blur-background
@@ -386,6 +394,21 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
   }
   // --resize-damage
   config_lookup_int(&cfg, "resize-damage", &opt->resize_damage);
+  // --damage-max-rects
+  config_lookup_int(&cfg, "damage-max-rects", &opt->damage_max_rects);
+  // --damage-overdraw
+  config_lookup_float(&cfg, "damage-overdraw", &opt->damage_overdraw);
+  // --damage-strategy
+  if (config_lookup_string(&cfg, "damage-strategy", &sval)) {
+    opt->damage_strategy = parse_damage_strategy(sval);
+    if (opt->damage_strategy >= NUM_DAMAGE_STRATEGIES) {
+      log_fatal("Cannot parse damage strategy");
+      exit(1);
+    }
+  }
+  // --damage-strategy-rule
+  parse_cfg_condlst_rule(&cfg, &opt->damage_strategy_rules, "damage-strategy-rule",
+      parse_rule_damage_strategy);
   // --glx-no-stencil
   lcfg_lookup_bool(&cfg, "glx-no-stencil", &opt->glx_no_stencil);
   // --glx-no-rebind-pixmap
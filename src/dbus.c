@@ -824,10 +824,17 @@ cdbus_process_win_get(session_t *ps, DBusMessage *msg) {
   cdbus_m_win_get_do(shadow_force, cdbus_reply_enum);
   cdbus_m_win_get_do(focused_force, cdbus_reply_enum);
   cdbus_m_win_get_do(invert_color_force, cdbus_reply_enum);
-  cdbus_m_win_get_do(name, cdbus_reply_string);
-  cdbus_m_win_get_do(class_instance, cdbus_reply_string);
-  cdbus_m_win_get_do(class_general, cdbus_reply_string);
-  cdbus_m_win_get_do(role, cdbus_reply_string);
+
+#define cdbus_m_win_get_istr_do(tgt) \
+  if (!strcmp(MSTR(tgt), target)) { \
+    cdbus_reply_string(ps, msg, istr_str(w->tgt)); \
+    return true; \
+  }
+  cdbus_m_win_get_istr_do(name);
+  cdbus_m_win_get_istr_do(class_instance);
+  cdbus_m_win_get_istr_do(class_general);
+  cdbus_m_win_get_istr_do(role);
+#undef cdbus_m_win_get_istr_do
 
   cdbus_m_win_get_do(opacity, cdbus_reply_uint32);
   cdbus_m_win_get_do(opacity_tgt, cdbus_reply_uint32);
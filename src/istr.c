@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <string.h>
+
+#include "compiler.h"
+#include "istr.h"
+#include "utils.h"
+
+/// All live interned strings.
+static istr_t *istr_table = NULL;
+
+/// FNV-1a hash of a string.
+static uint32_t istr_hash(const char *str, size_t len) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+istr_t *istr_get(const char *str) {
+	auto len = strlen(str);
+	auto hash = istr_hash(str, len);
+
+	istr_t *s = NULL;
+	HASH_FIND_BYHASHVALUE(hh, istr_table, str, len, hash, s);
+	if (s)
+		return istr_ref(s);
+
+	// The string and its folded copy are stored right after the header
+	s = allocchk(malloc(sizeof(istr_t) + 2 * (len + 1)));
+	s->refcount = 1;
+	s->len = len;
+	s->hash = hash;
+	memcpy(s->str, str, len + 1);
+
+	char *folded = s->str + len + 1;
+	for (size_t i = 0; i <= len; i++)
+		folded[i] = (str[i] >= 'A' && str[i] <= 'Z') ? str[i] - 'A' + 'a' : str[i];
+	s->folded = folded;
+	s->folded_hash = istr_hash(folded, len);
+
+	HASH_ADD_KEYPTR_BYHASHVALUE(hh, istr_table, s->str, len, hash, s);
+	return s;
+}
+
+void istr_unref(istr_t **ps) {
+	istr_t *s = *ps;
+	*ps = NULL;
+	if (!s || --s->refcount)
+		return;
+
+	HASH_DELETE(hh, istr_table, s);
+	free(s);
+}
+
+// vim: set noet sw=8 ts=8 :
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uthash.h"
+
+/// An interned string.
+///
+/// There is at most one istr_t for each distinct string, so two interned
+/// strings are equal iff their pointers are. Interned strings are immutable
+/// and reference counted.
+typedef struct istr {
+	unsigned refcount;
+	/// Length of the string, not including the terminating NUL.
+	size_t len;
+	/// Hash of the string.
+	uint32_t hash;
+	/// The string with ASCII letters folded to lower case, for case
+	/// insensitive comparisons.
+	const char *folded;
+	/// Hash of <code>folded</code>.
+	uint32_t folded_hash;
+	UT_hash_handle hh;
+	char str[];
+} istr_t;
+
+/// Get the interned copy of a string, with a new reference.
+istr_t *istr_get(const char *str);
+
+/// Take another reference to an interned string.
+static inline istr_t *istr_ref(istr_t *s) {
+	if (s)
+		s->refcount++;
+	return s;
+}
+
+/// Drop a reference to an interned string, and reset the pointer.
+void istr_unref(istr_t **ps);
+
+/// Get the C string of an interned string, NULL if there is none.
+static inline const char *istr_str(const istr_t *s) {
+	return s ? s->str : NULL;
+}
+
+// vim: set noet sw=8 ts=8 :
@@ -11,7 +11,6 @@
 /// Sum a region convolution kernel. Region is defined by a width x height rectangle whose
 /// top left corner is at (x, y)
 double sum_kernel(const conv *map, int x, int y, int width, int height) {
-	double ret = 0;
 	/*
 	 * Compute set of filter values which are "in range"
 	 */
@@ -34,20 +33,24 @@ double sum_kernel(const conv *map, int x, int y, int width, int height) {
 
 	int d = map->size;
 	if (map->rsum) {
-		double v1 = xstart ? map->rsum[(yend - 1) * d + xstart - 1] : 0;
-		double v2 = ystart ? map->rsum[(ystart - 1) * d + xend - 1] : 0;
-		double v3 =
+		// Sums of rectangles are exact and never negative, so unsigned
+		// arithmetic gives the right result
+		uint32_t v1 = xstart ? map->rsum[(yend - 1) * d + xstart - 1] : 0;
+		uint32_t v2 = ystart ? map->rsum[(ystart - 1) * d + xend - 1] : 0;
+		uint32_t v3 =
 		    (xstart && ystart) ? map->rsum[(ystart - 1) * d + xstart - 1] : 0;
-		return map->rsum[(yend - 1) * d + xend - 1] - v1 - v2 + v3;
+		return (map->rsum[(yend - 1) * d + xend - 1] - v1 - v2 + v3) /
+		       (double)KERNEL_SUM_ONE;
 	}
 
-	for (int yi = ystart; yi < yend; yi++) {
-		for (int xi = xstart; xi < xend; xi++) {
-			ret += map->data[yi * d + xi];
-		}
-	}
+	// The kernel is separable, so is the sum
+	double xsum = 0, ysum = 0;
+	for (int xi = xstart; xi < xend; xi++)
+		xsum += map->data[xi];
+	for (int yi = ystart; yi < yend; yi++)
+		ysum += map->data[yi];
 
-	return ret;
+	return xsum * ysum;
 }
 
 double sum_kernel_normalized(const conv *map, int x, int y, int width, int height) {
@@ -61,13 +64,15 @@ double sum_kernel_normalized(const conv *map, int x, int y, int width, int heigh
 	return ret;
 }
 
-static double attr_const gaussian(double r, double x, double y) {
+static double attr_const gaussian(double r, double x) {
 	// Formula can be found here:
 	// https://en.wikipedia.org/wiki/Gaussian_blur#Mathematics
+	// The two dimensional gaussian is the product of one dimensional ones.
+	// The scale factor is left out, as the kernel is normalized anyway.
 	// Except a special case for r == 0 to produce sharp shadows
 	if (r == 0)
 		return 1;
-	return exp(-0.5 * (x * x + y * y) / (r * r)) / (2 * M_PI * r * r);
+	return exp(-0.5 * x * x / (r * r));
 }
 
 conv *gaussian_kernel(double r) {
@@ -76,51 +81,59 @@ conv *gaussian_kernel(double r) {
 	int center = size / 2;
 	double t;
 
-	c = cvalloc(sizeof(conv) + size * size * sizeof(double));
+	c = cvalloc(sizeof(conv) + size * sizeof(double));
 	c->size = size;
 	c->rsum = NULL;
 	t = 0.0;
 
-	for (int y = 0; y < size; y++) {
-		for (int x = 0; x < size; x++) {
-			double g = gaussian(r, x - center, y - center);
-			t += g;
-			c->data[y * size + x] = g;
-		}
+	for (int x = 0; x < size; x++) {
+		double g = gaussian(r, x - center);
+		t += g;
+		c->data[x] = g;
 	}
 
-	for (int y = 0; y < size; y++) {
-		for (int x = 0; x < size; x++) {
-			c->data[y * size + x] /= t;
-		}
+	for (int x = 0; x < size; x++) {
+		c->data[x] /= t;
 	}
 
 	return c;
 }
 
+/// Fixed point 1.0 of the prefix sums along one axis. The product of two of
+/// them is KERNEL_SUM_ONE.
+#define KERNEL_AXIS_ONE (1u << 15)
+
 /// preprocess kernels to make shadow generation faster
-/// shadow_sum[x*d+y] is the sum of the kernel from (0, 0) to (x, y), inclusive
+/// rsum[y*d+x] is the sum of the kernel from (0, 0) to (x, y), inclusive, times
+/// KERNEL_SUM_ONE
 void shadow_preprocess(conv *map) {
 	const int d = map->size;
 
 	if (map->rsum)
 		free(map->rsum);
 
-	auto sum = map->rsum = ccalloc(d * d, double);
-	sum[0] = map->data[0];
-
-	for (int x = 1; x < d; x++) {
-		sum[x] = sum[x - 1] + map->data[x];
+	// Prefix sums along one axis. The kernel is separable, so the sum of
+	// the rectangle from (0, 0) to (x, y) is psum[x] * psum[y]. Being
+	// products of non-decreasing integers, the sums of all rectangles
+	// computed from the table are exact and never negative.
+	auto psum = ccalloc(d, uint32_t);
+	double acc = 0;
+	for (int i = 0; i < d; i++) {
+		acc += map->data[i];
+		psum[i] = acc * KERNEL_AXIS_ONE + 0.5;
+		if (psum[i] > KERNEL_AXIS_ONE)
+			psum[i] = KERNEL_AXIS_ONE;
 	}
+	// The weights are normalized, make sure the whole kernel sums to 1
+	psum[d - 1] = KERNEL_AXIS_ONE;
 
-	for (int y = 1; y < d; y++) {
-		sum[y * d] = sum[(y - 1) * d] + map->data[y * d];
-		for (int x = 1; x < d; x++) {
-			double tmp = sum[(y - 1) * d + x] + sum[y * d + x - 1] -
-			             sum[(y - 1) * d + x - 1];
-			sum[y * d + x] = tmp + map->data[y * d + x];
+	auto sum = map->rsum = ccalloc(d * d, uint32_t);
+	for (int y = 0; y < d; y++) {
+		for (int x = 0; x < d; x++) {
+			sum[y * d + x] = psum[y] * psum[x];
 		}
 	}
+	free(psum);
 }
 
 // vim: set noet sw=8 ts=8 :
@@ -2,14 +2,22 @@
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 
 #pragma once
+#include <stdint.h>
 #include <stdlib.h>
 #include "compiler.h"
 
 /// Code for generating convolution kernels
 
+/// Fixed point 1.0 of the sums in <code>conv::rsum</code>.
+#define KERNEL_SUM_ONE (1u << 30)
+
+/// A separable convolution kernel, the outer product of one dimensional
+/// weights with themselves.
 typedef struct conv {
 	int size;
-	double *rsum;
+	/// Summed-area table, in fixed point. Built by shadow_preprocess().
+	uint32_t *rsum;
+	/// Weights along one axis, <code>size</code> of them.
 	double data[];
 } conv;
 
@@ -22,7 +30,8 @@ double attr_const sum_kernel_normalized(const conv *map, int x, int y, int width
 conv *gaussian_kernel(double r);
 
 /// preprocess kernels to make shadow generation faster
-/// shadow_sum[x*d+y] is the sum of the kernel from (0, 0) to (x, y), inclusive
+/// rsum[y*d+x] is the sum of the kernel from (0, 0) to (x, y), inclusive, times
+/// KERNEL_SUM_ONE
 void shadow_preprocess(conv *map);
 
 static inline void free_conv(conv *k) {
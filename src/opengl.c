@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "win.h"
 #include "region.h"
+#include "render.h"
 #include "backend/gl/gl_common.h"
 
 #include "opengl.h"
@@ -444,6 +445,7 @@ glx_destroy(session_t *ps) {
   // Free all GLX resources of windows
   for (win *w = ps->list; w; w = w->next)
     free_win_res_glx(ps, w);
+  shadow_cache_free_glx(ps);
 
   // Free GLSL shaders/programs
   for (int i = 0; i < MAX_BLUR_PASS; ++i) {
@@ -246,7 +246,6 @@ free_paint_glx(session_t *ps, paint_t *ppaint) {
 static inline void
 free_win_res_glx(session_t *ps, win *w) {
   free_paint_glx(ps, &w->paint);
-  free_paint_glx(ps, &w->shadow_paint);
 #ifdef CONFIG_OPENGL
   free_glx_bc(ps, &w->glx_blur_cache);
 #endif
@@ -142,6 +142,14 @@ static void usage(int ret) {
 	    "  --shadow-exclude \'bounding_shaped\' or\n"
 	    "  --shadow-exclude \'bounding_shaped && !rounded_corners\' instead.)\n"
 	    "\n"
+	    "--shadow-cache-size size\n"
+	    "  Keep shadow images no window uses around for windows of the same\n"
+	    "  size, up to this many KiB. Defaults to 81920.\n"
+	    "\n"
+	    "--shadow-nine-slice\n"
+	    "  Paint shadows from corner and edge tiles built once, instead of\n"
+	    "  building a shadow image for each window size.\n"
+	    "\n"
 	    "--detect-rounded-corners\n"
 	    "  Try to detect windows with rounded corners and don't consider\n"
 	    "  them shaped windows. Affects --shadow-ignore-shaped,\n"
@@ -275,6 +283,22 @@ static void usage(int ret) {
 	    "  fixing the line corruption issues of blur. May or may not\n"
 	    "  work with --glx-no-stencil. Shrinking doesn't function correctly.\n"
 	    "\n"
+	    "--damage-max-rects integer\n"
+	    "  Merge rectangles of the damaged region when there are more than\n"
+	    "  this many, 0 to disable. Defaults to 64.\n"
+	    "\n"
+	    "--damage-overdraw fraction\n"
+	    "  How much area merging damage rectangles may add, as a fraction of\n"
+	    "  the damaged area, from 0 to 1. Defaults to 0.25.\n"
+	    "\n"
+	    "--damage-strategy strategy\n"
+	    "  How to find out which parts of windows are damaged. Possible\n"
+	    "  choices are rectangles, bounding-box (default) and non-empty.\n"
+	    "\n"
+	    "--damage-strategy-rule strategy:condition\n"
+	    "  Specify a list of damage strategy rules, in the format\n"
+	    "  \"STRATEGY:PATTERN\", like 'bounding-box:class_g = \"mpv\"'.\n"
+	    "\n"
 	    "--invert-color-include condition\n"
 	    "  Specify a list of conditions of windows that should be painted with\n"
 	    "  inverted color. Resource-hogging, and is not well tested.\n"
@@ -367,7 +391,10 @@ static void usage(int ret) {
 	    "  the whole screen is repainted.\n"
 	    "--monitor-repaint\n"
 	    "  Highlight the updated area of the screen. For debugging the xrender\n"
-	    "  backend only.\n";
+	    "  backend only.\n"
+	    "\n"
+	    "--startup-timing\n"
+	    "  Print how long the initial scan of existing windows took.\n";
 	FILE *f = (ret ? stderr : stdout);
 	fputs(usage_text, f);
 #undef WARNING
@@ -460,10 +487,17 @@ static const struct option longopts[] = {
     {"no-name-pixmap", no_argument, NULL, 320},
     {"log-level", required_argument, NULL, 321},
     {"log-file", required_argument, NULL, 322},
+    {"damage-strategy", required_argument, NULL, 323},
+    {"damage-strategy-rule", required_argument, NULL, 324},
+    {"damage-max-rects", required_argument, NULL, 325},
+    {"damage-overdraw", required_argument, NULL, 326},
+    {"shadow-cache-size", required_argument, NULL, 327},
+    {"shadow-nine-slice", no_argument, NULL, 328},
     {"reredir-on-root-change", no_argument, NULL, 731},
     {"glx-reinit-on-root-change", no_argument, NULL, 732},
     {"monitor-repaint", no_argument, NULL, 800},
     {"diagnostics", no_argument, NULL, 801},
+    {"startup-timing", no_argument, NULL, 802},
     // Must terminate with a NULL entry
     {NULL, 0, NULL, 0},
 };
@@ -775,11 +809,30 @@ void get_cfg(options_t *opt, int argc, char *const *argv, bool shadow_enable,
 			}
 			break;
 		}
+		case 323:
+			// --damage-strategy
+			opt->damage_strategy = parse_damage_strategy(optarg);
+			if (opt->damage_strategy >= NUM_DAMAGE_STRATEGIES)
+				exit(1);
+			break;
+		case 324:
+			// --damage-strategy-rule
+			if (!parse_rule_damage_strategy(&opt->damage_strategy_rules, optarg))
+				exit(1);
+			break;
+		P_CASELONG(325, damage_max_rects);
+		case 326:
+			// --damage-overdraw
+			opt->damage_overdraw = atof(optarg);
+			break;
+		P_CASELONG(327, shadow_cache_size);
+		P_CASEBOOL(328, shadow_nine_slice);
 		P_CASEBOOL(319, no_x_selection);
 		P_CASEBOOL(731, reredir_on_root_change);
 		P_CASEBOOL(732, glx_reinit_on_root_change);
 		P_CASEBOOL(800, monitor_repaint);
 		case 801: opt->print_diagnostics = true; break;
+		P_CASEBOOL(802, startup_timing);
 		default: usage(1); break;
 #undef P_CASEBOOL
 		}
@@ -852,6 +905,10 @@ void get_cfg(options_t *opt, int argc, char *const *argv, bool shadow_enable,
 	if (opt->resize_damage < 0)
 		log_warn("Negative --resize-damage will not work correctly.");
 
+	opt->damage_max_rects = max_i(opt->damage_max_rects, 0);
+	opt->shadow_cache_size = max_i(opt->shadow_cache_size, 0);
+	opt->damage_overdraw = normalize_d_range(opt->damage_overdraw, 0, 1);
+
 	if (opt->backend == BKEND_XRENDER && conv_kern_hasneg)
 		log_warn("A convolution kernel with negative values may not work "
 		         "properly under X Render backend.");
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "region.h"
+#include "utils.h"
+
+/// Overdraw a single merge may add in the first pass of region_simplify(), in
+/// pixels. Doubled every pass.
+#define REGION_SIMPLIFY_MIN_TOLERANCE 64
+
+static inline int64_t rect_area(const rect_t *r) {
+	return (int64_t)(r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static inline rect_t rect_bounds(const rect_t *a, const rect_t *b) {
+	return (rect_t){
+	    .x1 = min_i(a->x1, b->x1),
+	    .y1 = min_i(a->y1, b->y1),
+	    .x2 = max_i(a->x2, b->x2),
+	    .y2 = max_i(a->y2, b->y2),
+	};
+}
+
+/// Rectangles of a y-band of a region, or of several bands merged into a box.
+struct band {
+	/// Index of the first rectangle of the band
+	int first;
+	/// Number of rectangles, 1 once bands are merged
+	int n;
+	/// Bounding box of the band
+	rect_t bounds;
+	/// Area painted by the rectangles, including overdraw already added
+	int64_t area;
+};
+
+bool region_simplify(region_t *region, int max_rects, double overdraw) {
+	int nrects = 0;
+	const rect_t *rects = pixman_region32_rectangles(region, &nrects);
+	if (nrects <= max_rects)
+		return false;
+
+	auto boxes = ccalloc(nrects, rect_t);
+	memcpy(boxes, rects, sizeof(rect_t) * (size_t)nrects);
+	int nboxes = nrects;
+
+	const int64_t budget = (int64_t)((double)region_area(region) * overdraw);
+	int64_t used = 0;
+	bool merged = false;
+
+	// First merge neighbours within y-bands, tolerating more overdraw per
+	// merge every pass. Rectangles of a band don't overlap, and a merged box
+	// only covers its own band, so the overdraw of a merge is exactly the
+	// gap it closes.
+	for (int64_t tolerance = REGION_SIMPLIFY_MIN_TOLERANCE; nboxes > max_rects;
+	     tolerance *= 2) {
+		int n = 0;
+		for (int i = 0; i < nboxes; i++) {
+			rect_t *last = n ? &boxes[n - 1] : NULL;
+			if (last && last->y1 == boxes[i].y1 && last->y2 == boxes[i].y2) {
+				int64_t added = (int64_t)(boxes[i].x1 - last->x2) *
+				                (last->y2 - last->y1);
+				if (added <= tolerance && used + added <= budget) {
+					last->x2 = boxes[i].x2;
+					used += added;
+					merged = true;
+					continue;
+				}
+			}
+			boxes[n++] = boxes[i];
+		}
+		nboxes = n;
+
+		// A larger tolerance won't allow any merge the budget doesn't
+		if (tolerance >= budget)
+			break;
+	}
+
+	// Then merge whole neighbouring bands into one box each. Bands don't
+	// overlap, so the overdraw of a merge is exactly the bounding box minus
+	// what both bands already paint. The merged boxes don't overlap either,
+	// so the region keeps them as they are.
+	if (nboxes > max_rects) {
+		auto bands = ccalloc(nboxes, struct band);
+		int nbands = 0;
+		for (int i = 0; i < nboxes; i++) {
+			struct band *last = nbands ? &bands[nbands - 1] : NULL;
+			if (last && last->bounds.y1 == boxes[i].y1 &&
+			    last->bounds.y2 == boxes[i].y2) {
+				last->n++;
+				last->bounds = rect_bounds(&last->bounds, &boxes[i]);
+				last->area += rect_area(&boxes[i]);
+				continue;
+			}
+			bands[nbands++] = (struct band){
+			    .first = i, .n = 1, .bounds = boxes[i], .area = rect_area(&boxes[i])};
+		}
+
+		int count = nboxes;
+		for (int64_t tolerance = REGION_SIMPLIFY_MIN_TOLERANCE; count > max_rects;
+		     tolerance *= 2) {
+			int n = 0;
+			for (int i = 0; i < nbands; i++) {
+				struct band *last = n ? &bands[n - 1] : NULL;
+				if (last) {
+					rect_t bounds = rect_bounds(&last->bounds, &bands[i].bounds);
+					int64_t added =
+					    rect_area(&bounds) - last->area - bands[i].area;
+					if (added <= tolerance && used + added <= budget) {
+						count -= last->n + bands[i].n - 1;
+						last->n = 1;
+						last->bounds = bounds;
+						last->area = rect_area(&bounds);
+						used += added;
+						merged = true;
+						continue;
+					}
+				}
+				bands[n++] = bands[i];
+			}
+			nbands = n;
+
+			if (tolerance >= budget)
+				break;
+		}
+
+		// Bands merged into a box keep only their bounding box
+		int n = 0;
+		for (int i = 0; i < nbands; i++) {
+			if (bands[i].n == 1) {
+				boxes[n++] = bands[i].bounds;
+				continue;
+			}
+			memmove(&boxes[n], &boxes[bands[i].first],
+			        sizeof(rect_t) * (size_t)bands[i].n);
+			n += bands[i].n;
+		}
+		nboxes = n;
+		free(bands);
+	}
+
+	if (!merged) {
+		free(boxes);
+		return false;
+	}
+
+	pixman_region32_fini(region);
+	pixman_region32_init_rects(region, boxes, nboxes);
+	free(boxes);
+	assert(pixman_region32_n_rects(region) <= nboxes);
+	return true;
+}
+
+// vim: set noet sw=8 ts=8 :
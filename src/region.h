@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <pixman.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 #include "utils.h"
 #include "log.h"
@@ -31,6 +32,27 @@ dump_region(const region_t *x) {
     log_trace("(%d, %d) - (%d, %d)", rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
 }
 
+/// Get the number of pixels in a region
+static inline unsigned long
+region_area(const region_t *x) {
+  int nrects;
+  const rect_t *rects = pixman_region32_rectangles((region_t *)x, &nrects);
+  unsigned long area = 0;
+  for (int i = 0; i < nrects; i++)
+    area += (unsigned long)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+  return area;
+}
+
+/**
+ * Merge the rectangles of a region if there are more than <code>max_rects</code>
+ * of them, trading some overdraw for cheaper clipping and region operations.
+ *
+ * @param overdraw how much area merging may add, as a fraction of the area of
+ *                 the region
+ * @return whether the region was simplified
+ */
+bool region_simplify(region_t *region, int max_rects, double overdraw);
+
 /// Convert one xcb rectangle to our rectangle type
 static inline rect_t
 from_x_rect(const xcb_rectangle_t *rect) {
@@ -29,6 +29,7 @@
 #include "utils.h"
 
 #include "backend/backend_common.h"
+#include "uthash.h"
 #include "render.h"
 
 #ifdef CONFIG_OPENGL
@@ -382,8 +383,6 @@ void paint_one(session_t *ps, win *w, const region_t *reg_paint) {
 	glx_mark(ps, w->id, false);
 }
 
-extern const char *background_props_str[];
-
 static bool get_root_tile(session_t *ps) {
 	/*
 	if (ps->o.paint_on_overlay) {
@@ -397,9 +396,9 @@ static bool get_root_tile(session_t *ps) {
 	xcb_pixmap_t pixmap = XCB_NONE;
 
 	// Get the values of background attributes
-	for (int p = 0; background_props_str[p]; p++) {
-		winprop_t prop = wid_get_prop(
-		    ps, ps->root, get_atom(ps, background_props_str[p]), 1L, XCB_ATOM_PIXMAP, 32);
+	for (int p = 0; p < NUM_BACKGROUND_PROPS; p++) {
+		winprop_t prop = wid_get_prop(ps, ps->root, ps->atoms_background[p],
+		                              1L, XCB_ATOM_PIXMAP, 32);
 		if (prop.nitems) {
 			pixmap = *prop.p32;
 			fill = false;
@@ -470,92 +469,309 @@ static void paint_root(session_t *ps, const region_t *reg_paint) {
 }
 
 /**
- * Generate shadow <code>Picture</code> for a window.
+ * Upload (part of) a shadow image.
+ *
+ * @param x,y where to put the image in the uploaded picture, may be negative
+ *            to upload only its bottom right part
+ * @param repeat repeat attribute of the picture
  */
-static bool win_build_shadow(session_t *ps, win *w, double opacity) {
-	const int width = w->widthb;
-	const int height = w->heightb;
-	// log_trace("(): building shadow for %s %d %d", w->name, width, height);
+static bool upload_shadow(session_t *ps, xcb_image_t *shadow_image, int x, int y,
+                          int width, int height, uint32_t repeat, paint_t *paint) {
+	xcb_pixmap_t shadow_pixmap = x_create_pixmap(ps, 32, ps->root, width, height);
+	if (!shadow_pixmap) {
+		log_error("failed to create shadow pixmap");
+		return false;
+	}
+
+	xcb_render_create_picture_value_list_t pa = {.repeat = repeat};
+	xcb_render_picture_t shadow_picture = x_create_picture_with_standard_and_pixmap(
+	    ps, XCB_PICT_STANDARD_ARGB_32, shadow_pixmap, XCB_RENDER_CP_REPEAT, &pa);
+	if (!shadow_picture) {
+		xcb_free_pixmap(ps->c, shadow_pixmap);
+		return false;
+	}
 
-	xcb_image_t *shadow_image = NULL;
-	xcb_pixmap_t shadow_pixmap = XCB_NONE, shadow_pixmap_argb = XCB_NONE;
-	xcb_render_picture_t shadow_picture = XCB_NONE, shadow_picture_argb = XCB_NONE;
-	xcb_gcontext_t gc = XCB_NONE;
+	xcb_gcontext_t gc = xcb_generate_id(ps->c);
+	xcb_create_gc(ps->c, gc, shadow_pixmap, 0, NULL);
+	x_put_image(ps, shadow_pixmap, gc, shadow_image, x, y);
+	xcb_free_gc(ps->c, gc);
 
-	shadow_image = make_shadow(ps->c, ps->gaussian_map, opacity, width, height);
+	paint->pixmap = shadow_pixmap;
+	paint->pict = shadow_picture;
+	return true;
+}
+
+/**
+ * Generate a shadow image.
+ *
+ * @param size set to the estimated memory used by the image, in bytes
+ */
+static bool build_shadow_paint(session_t *ps, int width, int height, double opacity,
+                               paint_t *paint, size_t *size) {
+	xcb_image_t *shadow_image =
+	    make_shadow_argb(ps->c, ps->gaussian_map, opacity, width, height,
+	                     ps->o.shadow_red, ps->o.shadow_green, ps->o.shadow_blue);
 	if (!shadow_image) {
 		log_error("failed to make shadow");
-		return XCB_NONE;
+		return false;
 	}
 
-	shadow_pixmap = x_create_pixmap(ps, 8, ps->root, shadow_image->width, shadow_image->height);
-	shadow_pixmap_argb =
-	    x_create_pixmap(ps, 32, ps->root, shadow_image->width, shadow_image->height);
+	bool ret = upload_shadow(ps, shadow_image, 0, 0, shadow_image->width,
+	                         shadow_image->height, XCB_RENDER_REPEAT_NONE, paint);
+	*size = (size_t)shadow_image->width * shadow_image->height * 4;
+	xcb_image_destroy(shadow_image);
+	return ret;
+}
+
+/**
+ * Generate the tiles of nine-slice shadows.
+ *
+ * The shadow of a window at least 2r wide and high, r being the shadow radius,
+ * is made of 2r x 2r corners, edges that don't change along their length, and
+ * an opaque center. So it's the shadow of a (2r+1) x (2r+1) window, with its
+ * middle row and column stretched.
+ *
+ * That small shadow is split into four (2r+1) x (2r+1) tiles, one per corner,
+ * overlapping on the middle row and column. Each tile is padded with its edge
+ * pixels, so painting a quarter of a shadow of any size from it stretches the
+ * edges and the center as needed.
+ */
+static bool build_shadow_tiles(session_t *ps, paint_t tiles[4]) {
+	const int r = ps->gaussian_map->size / 2, t = r * 2 + 1;
+	xcb_image_t *shadow_image =
+	    make_shadow_argb(ps->c, ps->gaussian_map, 1, t, t, ps->o.shadow_red,
+	                     ps->o.shadow_green, ps->o.shadow_blue);
+	if (!shadow_image) {
+		log_error("failed to make shadow");
+		return false;
+	}
 
-	if (!shadow_pixmap || !shadow_pixmap_argb) {
-		log_error("failed to create shadow pixmaps");
-		goto shadow_picture_err;
+	bool ret = true;
+	for (int i = 0; i < 4 && ret; i++) {
+		ret = upload_shadow(ps, shadow_image, (i & 1) ? -2 * r : 0,
+		                    (i & 2) ? -2 * r : 0, t, t, XCB_RENDER_REPEAT_PAD,
+		                    &tiles[i]);
 	}
+	xcb_image_destroy(shadow_image);
 
-	shadow_picture = x_create_picture_with_standard_and_pixmap(
-	    ps, XCB_PICT_STANDARD_A_8, shadow_pixmap, 0, NULL);
-	shadow_picture_argb = x_create_picture_with_standard_and_pixmap(
-	    ps, XCB_PICT_STANDARD_ARGB_32, shadow_pixmap_argb, 0, NULL);
-	if (!shadow_picture || !shadow_picture_argb)
-		goto shadow_picture_err;
+	if (!ret) {
+		for (int i = 0; i < 4; i++)
+			free_paint(ps, &tiles[i]);
+	}
+	return ret;
+}
 
-	gc = xcb_generate_id(ps->c);
-	xcb_create_gc(ps->c, gc, shadow_pixmap, 0, NULL);
+/// What a shadow image looks like. Zeroed before being filled, so keys can be
+/// compared bytewise.
+struct shadow_key {
+	int width, height;
+	int radius;
+	double opacity;
+	double red, green, blue;
+};
+
+/// A shadow image, shared by all windows whose shadows look the same.
+struct shadow_entry {
+	struct shadow_key key;
+	paint_t paint;
+	/// Number of windows using the image.
+	unsigned refcount;
+	/// Estimated memory used by the image, in bytes.
+	size_t size;
+	/// Neighbours in the list of unused images, least recently used first.
+	struct shadow_entry *lru_prev, *lru_next;
+	UT_hash_handle hh;
+};
+
+/// Cache of shadow images. Images no window uses are kept around, up to
+/// <code>--shadow-cache-size</code>, for windows of the same size to come.
+struct shadow_cache {
+	struct shadow_entry *entries;
+	/// Unused images, least recently used first.
+	struct shadow_entry *lru_head, *lru_tail;
+	/// Memory used by unused images, in bytes.
+	size_t unused_size;
+	unsigned long nhits, nmisses, nevictions;
+
+	/// Tiles of nine-slice shadows, top left, top right, bottom left, bottom
+	/// right. Built on first use.
+	paint_t tiles[4];
+	/// Whether building the tiles has been tried.
+	bool tiles_tried;
+};
+
+static void shadow_lru_remove(struct shadow_cache *sc, struct shadow_entry *e) {
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		sc->lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		sc->lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
+	sc->unused_size -= e->size;
+}
 
-	xcb_image_put(ps->c, shadow_pixmap, gc, shadow_image, 0, 0, 0);
-	xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, ps->cshadow_picture,
-	                     shadow_picture, shadow_picture_argb, 0, 0, 0, 0, 0, 0,
-	                     shadow_image->width, shadow_image->height);
+static void shadow_entry_free(session_t *ps, struct shadow_cache *sc,
+                              struct shadow_entry *e) {
+	HASH_DEL(sc->entries, e);
+	free_paint(ps, &e->paint);
+	free(e);
+}
 
-	assert(!w->shadow_paint.pixmap);
-	w->shadow_paint.pixmap = shadow_pixmap_argb;
-	assert(!w->shadow_paint.pict);
-	w->shadow_paint.pict = shadow_picture_argb;
+/**
+ * Get a shadow image of a window size with a new reference, building it if
+ * it's not cached.
+ */
+static struct shadow_entry *shadow_get(session_t *ps, int width, int height) {
+	struct shadow_cache *sc = ps->shadow_cache;
+	struct shadow_key key;
+	memset(&key, 0, sizeof(key));
+	key.width = width;
+	key.height = height;
+	key.radius = ps->o.shadow_radius;
+	key.opacity = 1;
+	key.red = ps->o.shadow_red;
+	key.green = ps->o.shadow_green;
+	key.blue = ps->o.shadow_blue;
+
+	struct shadow_entry *e = NULL;
+	HASH_FIND(hh, sc->entries, &key, sizeof(key), e);
+	if (e) {
+		sc->nhits++;
+		if (!e->refcount++)
+			shadow_lru_remove(sc, e);
+		return e;
+	}
 
-	xcb_free_gc(ps->c, gc);
-	xcb_image_destroy(shadow_image);
-	xcb_free_pixmap(ps->c, shadow_pixmap);
-	xcb_render_free_picture(ps->c, shadow_picture);
+	sc->nmisses++;
+	e = ccalloc(1, struct shadow_entry);
+	e->key = key;
+	e->paint = (paint_t)PAINT_INIT;
+	if (!build_shadow_paint(ps, width, height, key.opacity, &e->paint, &e->size)) {
+		free(e);
+		return NULL;
+	}
+	e->refcount = 1;
+	HASH_ADD(hh, sc->entries, key, sizeof(key), e);
+	return e;
+}
 
-	return true;
+void shadow_release(session_t *ps, struct shadow_entry **pe) {
+	struct shadow_entry *e = *pe;
+	*pe = NULL;
+	if (!e || --e->refcount)
+		return;
 
-shadow_picture_err:
-	if (shadow_image)
-		xcb_image_destroy(shadow_image);
-	if (shadow_pixmap)
-		xcb_free_pixmap(ps->c, shadow_pixmap);
-	if (shadow_pixmap_argb)
-		xcb_free_pixmap(ps->c, shadow_pixmap_argb);
-	if (shadow_picture)
-		xcb_render_free_picture(ps->c, shadow_picture);
-	if (shadow_picture_argb)
-		xcb_render_free_picture(ps->c, shadow_picture_argb);
-	if (gc)
-		xcb_free_gc(ps->c, gc);
-
-	return false;
+	struct shadow_cache *sc = ps->shadow_cache;
+	e->lru_prev = sc->lru_tail;
+	if (sc->lru_tail)
+		sc->lru_tail->lru_next = e;
+	else
+		sc->lru_head = e;
+	sc->lru_tail = e;
+	sc->unused_size += e->size;
+
+	while (sc->lru_head && sc->unused_size > (size_t)ps->o.shadow_cache_size * 1024) {
+		struct shadow_entry *victim = sc->lru_head;
+		shadow_lru_remove(sc, victim);
+		shadow_entry_free(ps, sc, victim);
+		sc->nevictions++;
+	}
+}
+
+#ifdef CONFIG_OPENGL
+void shadow_cache_free_glx(session_t *ps) {
+	struct shadow_cache *sc = ps->shadow_cache;
+	if (!sc)
+		return;
+
+	// Textures are bound again from the pixmaps when next painted
+	struct shadow_entry *e, *tmp;
+	HASH_ITER(hh, sc->entries, e, tmp) {
+		free_paint_glx(ps, &e->paint);
+	}
+	for (int i = 0; i < 4; i++)
+		free_paint_glx(ps, &sc->tiles[i]);
+}
+#endif
+
+/**
+ * Check whether the shadow of a window should be painted from nine-slice
+ * tiles, building the tiles if they aren't yet.
+ */
+static bool shadow_use_tiles(session_t *ps, const win *w) {
+	struct shadow_cache *sc = ps->shadow_cache;
+	const int r = ps->gaussian_map->size / 2;
+	if (!ps->o.shadow_nine_slice || w->widthb < r * 2 || w->heightb < r * 2)
+		return false;
+
+	if (!sc->tiles_tried) {
+		sc->tiles_tried = true;
+		if (!build_shadow_tiles(ps, sc->tiles))
+			log_error("Failed to build nine-slice shadow tiles, shadows will be "
+			          "built for each window size.");
+	}
+	return sc->tiles[0].pixmap;
+}
+
+/**
+ * Paint the shadow of a window from the nine-slice tiles, a quarter from each.
+ */
+static void win_paint_shadow_tiles(session_t *ps, win *w, region_t *reg_paint) {
+	const int t = ps->gaussian_map->size;
+	const int half_width = w->shadow_width / 2, half_height = w->shadow_height / 2;
+	for (int i = 0; i < 4; i++) {
+		paint_t *tile = &ps->shadow_cache->tiles[i];
+		paint_bind_tex(ps, tile, 0, 0, 32, false);
+		if (!paint_isvalid(ps, tile)) {
+			log_error("Shadow tile %d is invalid.", i);
+			return;
+		}
+
+		// Part of the shadow to paint, and where its pixels are in the tile.
+		// Pixels outside of the tile are padded with its middle row and
+		// column.
+		const bool right = i & 1, bottom = i & 2;
+		const int x = right ? half_width : 0, y = bottom ? half_height : 0;
+		const int wid = right ? w->shadow_width - half_width : half_width;
+		const int hei = bottom ? w->shadow_height - half_height : half_height;
+		const int tx = x - (right ? w->shadow_width - t : 0);
+		const int ty = y - (bottom ? w->shadow_height - t : 0);
+
+		render(ps, tx, ty, w->g.x + w->shadow_dx + x, w->g.y + w->shadow_dy + y,
+		       wid, hei, w->shadow_opacity, true, false, tile->pict, tile->ptex,
+		       reg_paint, NULL);
+	}
 }
 
 /**
  * Paint the shadow of a window.
  */
 static inline void win_paint_shadow(session_t *ps, win *w, region_t *reg_paint) {
+	if (shadow_use_tiles(ps, w)) {
+		win_paint_shadow_tiles(ps, w, reg_paint);
+		return;
+	}
+
+	if (!w->shadow_image) {
+		log_error("Window %#010x is missing shadow data.", w->id);
+		return;
+	}
+	paint_t *shadow_paint = &w->shadow_image->paint;
+
 	// Bind shadow pixmap to GLX texture if needed
-	paint_bind_tex(ps, &w->shadow_paint, 0, 0, 32, false);
+	paint_bind_tex(ps, shadow_paint, 0, 0, 32, false);
 
-	if (!paint_isvalid(ps, &w->shadow_paint)) {
+	if (!paint_isvalid(ps, shadow_paint)) {
 		log_error("Window %#010x is missing shadow data.", w->id);
 		return;
 	}
 
 	render(ps, 0, 0, w->g.x + w->shadow_dx, w->g.y + w->shadow_dy, w->shadow_width,
-	       w->shadow_height, w->shadow_opacity, true, false, w->shadow_paint.pict,
-	       w->shadow_paint.ptex, reg_paint, NULL);
+	       w->shadow_height, w->shadow_opacity, true, false, shadow_paint->pict,
+	       shadow_paint->ptex, reg_paint, NULL);
 }
 
 /**
@@ -789,6 +1005,19 @@ void paint_all(session_t *ps, win *const t, bool ignore_damage) {
 	// Remove the damaged area out of screen
 	pixman_region32_intersect(&region, &region, &ps->screen_reg);
 
+	// Keep the damage cheap to clip with. This is done once per frame on
+	// the exact damage, so the overdraw budget holds.
+	if (ps->o.damage_max_rects) {
+		int nrects = pixman_region32_n_rects(&region);
+		if (region_simplify(&region, ps->o.damage_max_rects,
+		                    ps->o.damage_overdraw)) {
+			ps->ndamage_simplified++;
+			ps->ndamage_rects_before += (unsigned long)nrects;
+			ps->ndamage_rects_after +=
+			    (unsigned long)pixman_region32_n_rects(&region);
+		}
+	}
+
 	if (!paint_isvalid(ps, &ps->tgt_buffer)) {
 		if (!ps->tgt_buffer.pixmap) {
 			free_paint(ps, &ps->tgt_buffer);
@@ -841,10 +1070,12 @@ void paint_all(session_t *ps, win *const t, bool ignore_damage) {
 		region_t bshape = win_get_bounding_shape_global_by_val(w);
 		// Painting shadow
 		if (w->shadow) {
-			// Lazy shadow building
-			if (!w->shadow_paint.pixmap)
-				if (!win_build_shadow(ps, w, 1))
+			// Lazy shadow building, not needed for nine-slice shadows
+			if (!w->shadow_image && !shadow_use_tiles(ps, w)) {
+				w->shadow_image = shadow_get(ps, w->widthb, w->heightb);
+				if (!w->shadow_image)
 					log_error("build shadow failed");
+			}
 
 			// Shadow doesn't need to be painted underneath the body
 			// of the windows above. Because no one can see it
@@ -1085,6 +1316,8 @@ static bool init_alpha_picts(session_t *ps) {
 }
 
 bool init_render(session_t *ps) {
+	ps->shadow_cache = ccalloc(1, struct shadow_cache);
+
 	// Initialize OpenGL as early as possible
 	if (bkend_use_glx(ps)) {
 #ifdef CONFIG_OPENGL
@@ -1144,19 +1377,6 @@ bool init_render(session_t *ps) {
 		return false;
 	}
 
-	// Generates another Picture for shadows if the color is modified by
-	// user
-	if (!ps->o.shadow_red && !ps->o.shadow_green && !ps->o.shadow_blue) {
-		ps->cshadow_picture = ps->black_picture;
-	} else {
-		ps->cshadow_picture = solid_picture(
-		    ps, true, 1, ps->o.shadow_red, ps->o.shadow_green, ps->o.shadow_blue);
-		if (ps->cshadow_picture == XCB_NONE) {
-			log_error("Failed to create shadow picture.");
-			return false;
-		}
-	}
-
 	ps->ndamage = maximum_buffer_age(ps);
 	ps->damage_ring = ccalloc(ps->ndamage, region_t);
 	ps->damage = ps->damage_ring + ps->ndamage - 1;
@@ -1186,18 +1406,28 @@ void free_root_tile(session_t *ps) {
 }
 
 void deinit_render(session_t *ps) {
+	// Free shadow images, all windows are gone already
+	struct shadow_cache *sc = ps->shadow_cache;
+	if (sc) {
+		if (sc->nhits || sc->nmisses)
+			log_debug("Shadow cache: %lu hits, %lu misses, %lu evictions.",
+			          sc->nhits, sc->nmisses, sc->nevictions);
+		struct shadow_entry *e, *tmp;
+		HASH_ITER(hh, sc->entries, e, tmp) {
+			shadow_entry_free(ps, sc, e);
+		}
+		for (int i = 0; i < 4; i++)
+			free_paint(ps, &sc->tiles[i]);
+		free(sc);
+		ps->shadow_cache = NULL;
+	}
+
 	// Free alpha_picts
 	for (int i = 0; i <= MAX_ALPHA; ++i)
 		free_picture(ps->c, &ps->alpha_picts[i]);
 	free(ps->alpha_picts);
 	ps->alpha_picts = NULL;
 
-	// Free cshadow_picture and black_picture
-	if (ps->cshadow_picture == ps->black_picture)
-		ps->cshadow_picture = XCB_NONE;
-	else
-		free_picture(ps->c, &ps->cshadow_picture);
-
 	free_picture(ps->c, &ps->black_picture);
 	free_picture(ps->c, &ps->white_picture);
 	free_conv(ps->gaussian_map);
@@ -32,6 +32,14 @@ paint_all(session_t *ps, win * const t, bool ignore_damage);
 void free_picture(xcb_connection_t *c, xcb_render_picture_t *p);
 
 void free_paint(session_t *ps, paint_t *ppaint);
+
+struct shadow_entry;
+/// Drop a reference to a shadow image, and reset the pointer.
+void shadow_release(session_t *ps, struct shadow_entry **pe);
+/// Free the GLX textures of cached shadow images and nine-slice tiles, for
+/// when the GLX context goes away.
+void shadow_cache_free_glx(session_t *ps);
+
 void free_root_tile(session_t *ps);
 
 bool init_render(session_t *ps);
@@ -5,6 +5,7 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/render.h>
 #include <xcb/damage.h>
 #include <xcb/xcb_renderutil.h>
@@ -42,6 +43,13 @@
   return ret; \
 }
 
+/// Damage report levels of the damage strategies.
+static const uint8_t damage_report_levels[NUM_DAMAGE_STRATEGIES] = {
+  [DAMAGE_RECTANGLES] = XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES,
+  [DAMAGE_BOUNDING_BOX] = XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX,
+  [DAMAGE_NON_EMPTY] = XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY,
+};
+
 /**
  * Clear leader cache of all windows.
  */
@@ -178,83 +186,233 @@ void win_rounded_corners(session_t *ps, win *w) {
     }
 }
 
-int win_get_name(session_t *ps, win *w) {
-  XTextProperty text_prop = { NULL, XCB_NONE, 0, 0 };
+/**
+ * Replace an interned string of a window.
+ *
+ * @return whether the string changed
+ */
+static bool win_set_istr(istr_t **s, const char *str) {
+  istr_t *snew = str ? istr_get(str) : NULL;
+  // Interned strings are equal iff their pointers are
+  bool changed = snew != *s;
+  istr_unref(s);
+  *s = snew;
+  return changed;
+}
+
+/**
+ * Update the name of a window from the replies to the requests for its
+ * <code>_NET_WM_NAME</code> and <code>WM_NAME</code>.
+ *
+ * @return whether the name changed
+ */
+static bool win_set_name(session_t *ps, win *w, xcb_get_property_reply_t *r_ewmh,
+                         xcb_get_property_reply_t *r) {
   char **strlst = NULL;
   int nstr = 0;
 
-  if (!w->client_win)
-    return 0;
-
-  if (!(wid_get_text_prop(ps, w->client_win, ps->atom_name_ewmh, &strlst, &nstr))) {
+  if (!x_text_prop_to_strlst(ps, r_ewmh, &strlst, &nstr)) {
     log_trace("(%#010x): _NET_WM_NAME unset, falling back to WM_NAME.", w->client_win);
 
-    if (!(XGetWMName(ps->dpy, w->client_win, &text_prop) && text_prop.value)) {
-      return -1;
-    }
-    if (Success !=
-        XmbTextPropertyToTextList(ps->dpy, &text_prop, &strlst, &nstr)
-        || !nstr || !strlst) {
-      if (strlst)
-        XFreeStringList(strlst);
-      cxfree(text_prop.value);
-      return -1;
-    }
-    cxfree(text_prop.value);
-  }
-
-  int ret = 0;
-  if (!w->name || strcmp(w->name, strlst[0]) != 0) {
-    ret = 1;
-    free(w->name);
-    w->name = strdup(strlst[0]);
+    if (!x_text_prop_to_strlst(ps, r, &strlst, &nstr))
+      return false;
   }
 
+  bool changed = win_set_istr(&w->name, strlst[0]);
   XFreeStringList(strlst);
 
   log_trace("(%#010x): client = %#010x, name = \"%s\", "
-            "ret = %d", w->id, w->client_win, w->name, ret);
-  return ret;
+            "changed = %d", w->id, w->client_win, istr_str(w->name), changed);
+  return changed;
 }
 
-int win_get_role(session_t *ps, win *w) {
+/**
+ * Update the role of a window from the reply to the request for its
+ * <code>WM_WINDOW_ROLE</code>.
+ *
+ * @return whether the role changed
+ */
+static bool win_set_role(session_t *ps, win *w, xcb_get_property_reply_t *r) {
   char **strlst = NULL;
   int nstr = 0;
 
-  if (!wid_get_text_prop(ps, w->client_win, ps->atom_role, &strlst, &nstr))
-    return -1;
+  if (!x_text_prop_to_strlst(ps, r, &strlst, &nstr))
+    return false;
+
+  bool changed = win_set_istr(&w->role, strlst[0]);
+  XFreeStringList(strlst);
+
+  log_trace("(%#010x): client = %#010x, role = \"%s\", "
+            "changed = %d", w->id, w->client_win, istr_str(w->role), changed);
+  return changed;
+}
+
+/**
+ * Update the classes of a window from the reply to the request for its
+ * <code>WM_CLASS</code>.
+ *
+ * @return whether the classes changed
+ */
+static bool win_set_class(session_t *ps, win *w, xcb_get_property_reply_t *r) {
+  char **strlst = NULL;
+  int nstr = 0;
 
-  int ret = 0;
-  if (!w->role || strcmp(w->role, strlst[0]) != 0) {
-    ret = 1;
-    free(w->role);
-    w->role = strdup(strlst[0]);
+  // Drop the old strings if the property is gone
+  if (!x_text_prop_to_strlst(ps, r, &strlst, &nstr)) {
+    bool changed = w->class_instance || w->class_general;
+    istr_unref(&w->class_instance);
+    istr_unref(&w->class_general);
+    return changed;
   }
 
+  bool changed = win_set_istr(&w->class_instance, strlst[0]);
+  changed |= win_set_istr(&w->class_general, nstr > 1 ? strlst[1] : NULL);
   XFreeStringList(strlst);
 
-  log_trace("(%#010x): client = %#010x, role = \"%s\", "
-            "ret = %d", w->id, w->client_win, w->role, ret);
-  return ret;
+  log_trace("(%#010x): client = %#010x, "
+            "instance = \"%s\", general = \"%s\"",
+            w->id, w->client_win, istr_str(w->class_instance),
+            istr_str(w->class_general));
+  return changed;
 }
 
 /**
- * Check if a window is bounding-shaped.
+ * Drop some of the outstanding text property requests of a window.
  */
-static inline bool win_bounding_shaped(const session_t *ps, xcb_window_t wid) {
-  if (ps->shape_exists) {
-    xcb_shape_query_extents_reply_t *reply;
-    Bool bounding_shaped;
+static void win_discard_text_fetch(session_t *ps, win *w, unsigned props) {
+  props &= w->text_fetching;
+  if (!props)
+    return;
+
+  for (int i = 0; i < NUM_WIN_TEXT_PROPS; i++) {
+    if (!(props & (1u << i)))
+      continue;
+    xcb_discard_reply(ps->c, w->text_fetch[i].sequence);
+    if (i == WIN_TEXT_NAME)
+      xcb_discard_reply(ps->c, w->text_fetch_name_ewmh.sequence);
+  }
+
+  w->text_fetching &= ~props;
+  if (!w->text_fetching)
+    ps->nwins_fetching_text--;
+}
+
+void win_cancel_text_fetch(session_t *ps, win *w) {
+  win_discard_text_fetch(ps, w, w->text_fetching);
+}
+
+void win_fetch_text_props(session_t *ps, win *w, unsigned props) {
+  if (!w->client_win || !props)
+    return;
 
-    reply = xcb_shape_query_extents_reply(ps->c,
-        xcb_shape_query_extents(ps->c, wid), NULL);
-    bounding_shaped = reply && reply->bounding_shaped;
-    free(reply);
+  // Replies to the superseded requests would be stale
+  win_discard_text_fetch(ps, w, props);
 
-    return bounding_shaped;
+  const xcb_atom_t atoms[] = {
+    [WIN_TEXT_NAME] = ps->atom_name,
+    [WIN_TEXT_CLASS] = ps->atom_class,
+    [WIN_TEXT_ROLE] = ps->atom_role,
+  };
+  for (int i = 0; i < NUM_WIN_TEXT_PROPS; i++) {
+    if (!(props & (1u << i)))
+      continue;
+    // WM_NAME must be requested last, see win_poll_text_props()
+    if (i == WIN_TEXT_NAME)
+      w->text_fetch_name_ewmh = xcb_get_property(ps->c, 0, w->client_win,
+          ps->atom_name_ewmh, XCB_GET_PROPERTY_TYPE_ANY, 0, X_TEXT_PROP_MAX_LEN);
+    w->text_fetch[i] = xcb_get_property(ps->c, 0, w->client_win, atoms[i],
+        XCB_GET_PROPERTY_TYPE_ANY, 0, X_TEXT_PROP_MAX_LEN);
+#ifndef NDEBUG
+    w->text_fetch_time[i] = get_time_timespec();
+#endif
   }
 
-  return false;
+  if (!w->text_fetching)
+    ps->nwins_fetching_text++;
+  w->text_fetching |= props;
+}
+
+/**
+ * Apply the reply to a text property request of a window.
+ *
+ * @param has_r whether the reply to the request has already been collected,
+ *              otherwise wait for it here
+ * @param r the collected reply, NULL if the request failed
+ * @return the window attributes that changed, a mask of
+ *         <code>enum c2_dep</code>
+ */
+static unsigned win_finish_text_prop(session_t *ps, win *w, enum win_text_prop prop,
+                                     bool has_r, xcb_get_property_reply_t *r) {
+  assert(w->text_fetching & (1u << prop));
+  w->text_fetching &= ~(1u << prop);
+  if (!w->text_fetching)
+    ps->nwins_fetching_text--;
+
+  if (!has_r)
+    r = xcb_get_property_reply(ps->c, w->text_fetch[prop], NULL);
+
+#ifndef NDEBUG
+  struct timespec now = get_time_timespec();
+  double us = timespec_ms_between(&w->text_fetch_time[prop], &now) * 1000;
+  int bucket = 0;
+  while (bucket < TEXT_FETCH_LATENCY_BUCKETS - 1 && us >= (1 << bucket))
+    bucket++;
+  ps->text_fetch_latency[bucket]++;
+#endif
+
+  unsigned changed = 0;
+  switch (prop) {
+  case WIN_TEXT_NAME: {
+    xcb_get_property_reply_t *r_ewmh =
+      xcb_get_property_reply(ps->c, w->text_fetch_name_ewmh, NULL);
+    if (win_set_name(ps, w, r_ewmh, r))
+      changed = C2_DEP_NAME;
+    free(r_ewmh);
+    break;
+  }
+  case WIN_TEXT_CLASS:
+    if (win_set_class(ps, w, r))
+      changed = C2_DEP_CLASS;
+    break;
+  case WIN_TEXT_ROLE:
+    if (win_set_role(ps, w, r))
+      changed = C2_DEP_ROLE;
+    break;
+  default: unreachable;
+  }
+
+  free(r);
+  return changed;
+}
+
+unsigned win_finish_text_fetch(session_t *ps, win *w) {
+  unsigned changed = 0;
+  for (int i = 0; i < NUM_WIN_TEXT_PROPS; i++)
+    if (w->text_fetching & (1u << i))
+      changed |= win_finish_text_prop(ps, w, i, false, NULL);
+  return changed;
+}
+
+bool win_poll_text_props(session_t *ps) {
+  bool progress = false;
+  for (win *w = ps->list; w && ps->nwins_fetching_text; w = w->next) {
+    unsigned changed = 0;
+    for (int i = 0; i < NUM_WIN_TEXT_PROPS; i++) {
+      if (!(w->text_fetching & (1u << i)))
+        continue;
+
+      // Replies arrive in request order, so once the reply for WM_NAME is
+      // here, the one for _NET_WM_NAME is too.
+      xcb_get_property_reply_t *r = NULL;
+      if (xcb_poll_for_reply(ps->c, w->text_fetch[i].sequence, (void **)&r, NULL)) {
+        changed |= win_finish_text_prop(ps, w, i, true, r);
+        progress = true;
+      }
+    }
+    if (changed)
+      win_mark_factor_change(ps, w, changed, XCB_NONE);
+  }
+  return progress;
 }
 
 wintype_t wid_get_prop_wintype(session_t *ps, xcb_window_t wid) {
@@ -551,6 +709,32 @@ void win_update_opacity_rule(session_t *ps, win *w) {
     wid_set_opacity_prop(ps, w->id, opacity);
 }
 
+/**
+ * Update the damage strategy of a window from the damage strategy rules.
+ */
+static void win_update_damage_strategy(session_t *ps, win *w) {
+  if (w->a.map_state != XCB_MAP_STATE_VIEWABLE || !w->damage)
+    return;
+
+  enum damage_strategy strategy = ps->o.damage_strategy;
+  void *val = NULL;
+  if (c2_match(ps, w, ps->o.damage_strategy_rules, &w->cache_dsrule, &val))
+    strategy = (enum damage_strategy)((intptr_t)val - 1);
+
+  if (strategy == w->damage_strategy)
+    return;
+
+  // The report level of a damage object is fixed, so replace it. The new
+  // one starts out empty, repaint the whole window to not miss anything.
+  xcb_damage_damage_t old = w->damage;
+  w->damage = xcb_generate_id(ps->c);
+  set_ignore_cookie(ps, xcb_damage_create(ps->c, w->damage, w->id,
+    damage_report_levels[strategy]));
+  set_ignore_cookie(ps, xcb_damage_destroy(ps->c, old));
+  w->damage_strategy = strategy;
+  add_damage_from_win(ps, w);
+}
+
 /**
  * Function to be called on window type changes.
  */
@@ -565,28 +749,76 @@ void win_on_wtype_change(session_t *ps, win *w) {
 }
 
 /**
- * Function to be called on window data changes.
+ * Re-evaluate some of the condition lists of a window.
+ *
+ * @param rules mask of <code>enum win_rules</code>
  */
-void win_on_factor_change(session_t *ps, win *w) {
-  if (ps->o.shadow_blacklist)
+void win_update_rules(session_t *ps, win *w, unsigned rules) {
+  // Leaves shared between the lists below are only evaluated once
+  bool memoized = c2_match_begin(ps, w);
+
+  if (ps->o.shadow_blacklist && (rules & WIN_RULES_SHADOW))
     win_determine_shadow(ps, w);
-  if (ps->o.fade_blacklist)
+  if (ps->o.fade_blacklist && (rules & WIN_RULES_FADE))
     win_determine_fade(ps, w);
-  if (ps->o.invert_color_list)
+  if (ps->o.invert_color_list && (rules & WIN_RULES_INVERT_COLOR))
     win_determine_invert_color(ps, w);
-  if (ps->o.focus_blacklist)
+  if (ps->o.focus_blacklist && (rules & WIN_RULES_FOCUS))
     win_update_focused(ps, w);
-  if (ps->o.blur_background_blacklist)
+  if (ps->o.blur_background_blacklist && (rules & WIN_RULES_BLUR_BACKGROUND))
     win_determine_blur_background(ps, w);
-  if (ps->o.opacity_rules)
+  if (ps->o.opacity_rules && (rules & WIN_RULES_OPACITY))
     win_update_opacity_rule(ps, w);
-  if (w->a.map_state == XCB_MAP_STATE_VIEWABLE && ps->o.paint_blacklist)
+  if (ps->o.damage_strategy_rules && (rules & WIN_RULES_DAMAGE))
+    win_update_damage_strategy(ps, w);
+  if (w->a.map_state == XCB_MAP_STATE_VIEWABLE && ps->o.paint_blacklist
+      && (rules & WIN_RULES_PAINT))
     w->paint_excluded =
         c2_match(ps, w, ps->o.paint_blacklist, &w->cache_pblst, NULL);
-  if (w->a.map_state == XCB_MAP_STATE_VIEWABLE && ps->o.unredir_if_possible_blacklist)
+  if (w->a.map_state == XCB_MAP_STATE_VIEWABLE && ps->o.unredir_if_possible_blacklist
+      && (rules & WIN_RULES_UNREDIR))
     w->unredir_if_possible_excluded = c2_match(
         ps, w, ps->o.unredir_if_possible_blacklist, &w->cache_uipblst, NULL);
   w->reg_ignore_valid = false;
+
+  if (memoized)
+    c2_match_end(ps);
+}
+
+/**
+ * Function to be called on window data changes.
+ */
+void win_on_factor_change(session_t *ps, win *w) {
+  win_update_rules(ps, w, WIN_RULES_ALL);
+}
+
+void win_mark_factor_change(session_t *ps, win *w, unsigned deps, xcb_atom_t atom) {
+  const struct {
+    const c2_lptr_t *list;
+    enum win_rules rule;
+  } lists[] = {
+    { ps->o.shadow_blacklist, WIN_RULES_SHADOW },
+    { ps->o.fade_blacklist, WIN_RULES_FADE },
+    { ps->o.invert_color_list, WIN_RULES_INVERT_COLOR },
+    { ps->o.focus_blacklist, WIN_RULES_FOCUS },
+    { ps->o.blur_background_blacklist, WIN_RULES_BLUR_BACKGROUND },
+    { ps->o.opacity_rules, WIN_RULES_OPACITY },
+    { ps->o.damage_strategy_rules, WIN_RULES_DAMAGE },
+    { ps->o.paint_blacklist, WIN_RULES_PAINT },
+    { ps->o.unredir_if_possible_blacklist, WIN_RULES_UNREDIR },
+  };
+
+  unsigned rules = 0;
+  for (size_t i = 0; i < ARR_SIZE(lists); i++)
+    if (c2_list_depends_on(lists[i].list, deps, atom))
+      rules |= lists[i].rule;
+  if (!rules)
+    return;
+
+  // Applications like terminals can change their titles many times per
+  // frame, evaluate the rules only once
+  w->stale_rules |= rules;
+  queue_redraw(ps);
 }
 
 /**
@@ -598,7 +830,7 @@ void calc_win_size(session_t *ps, win *w) {
   calc_shadow_geometry(ps, w);
   w->flags |= WFLAG_SIZE_CHANGE;
   // Invalidate the shadow we built
-  free_paint(ps, &w->shadow_paint);
+  shadow_release(ps, &w->shadow_image);
 }
 
 /**
@@ -643,7 +875,13 @@ void win_upd_wintype(session_t *ps, win *w) {
  * @param client window ID of the client window
  */
 void win_mark_client(session_t *ps, win *w, xcb_window_t client) {
+  if (w->client_win)
+    HASH_DELETE(hh_client, ps->windows_by_client, w);
+  c2_prop_cache_clear(w);
+  win_cancel_text_fetch(ps, w);
   w->client_win = client;
+  if (client)
+    HASH_ADD(hh_client, ps->windows_by_client, client_win, sizeof(w->client_win), w);
 
   // If the window isn't mapped yet, stop here, as the function will be
   // called in map_win()
@@ -656,6 +894,11 @@ void win_mark_client(session_t *ps, win *w, xcb_window_t client) {
   // Make sure the XSelectInput() requests are sent
   XFlush(ps->dpy);
 
+  // Request window name and class if we are tracking them, so the replies
+  // arrive while the properties below are read
+  if (ps->o.track_wdata)
+    win_fetch_text_props(ps, w, (1u << NUM_WIN_TEXT_PROPS) - 1);
+
   win_upd_wintype(ps, w);
 
   // Get frame widths. The window is in damaged area already.
@@ -666,12 +909,9 @@ void win_mark_client(session_t *ps, win *w, xcb_window_t client) {
   if (ps->o.track_leader)
     win_update_leader(ps, w);
 
-  // Get window name and class if we are tracking them
-  if (ps->o.track_wdata) {
-    win_get_name(ps, w);
-    win_get_class(ps, w);
-    win_get_role(ps, w);
-  }
+  // Collect window name and class if we are tracking them
+  if (ps->o.track_wdata)
+    win_finish_text_fetch(ps, w);
 
   // Update everything related to conditions
   win_on_factor_change(ps, w);
@@ -689,7 +929,11 @@ void win_mark_client(session_t *ps, win *w, xcb_window_t client) {
 void win_unmark_client(session_t *ps, win *w) {
   xcb_window_t client = w->client_win;
 
+  if (client)
+    HASH_DELETE(hh_client, ps->windows_by_client, w);
   w->client_win = XCB_NONE;
+  c2_prop_cache_clear(w);
+  win_cancel_text_fetch(ps, w);
 
   // Recheck event mask
   xcb_change_window_attributes(ps->c, client, XCB_CW_EVENT_MASK,
@@ -730,11 +974,93 @@ void win_recheck_client(session_t *ps, win *w) {
   win_mark_client(ps, w, cw);
 }
 
+void win_unindex(session_t *ps, win *w) {
+  HASH_DELETE(hh, ps->windows, w);
+  if (w->client_win)
+    HASH_DELETE(hh_client, ps->windows_by_client, w);
+}
+
+void win_stack_insert(session_t *ps, win *w, win *below) {
+  win *above = below ? below->prev : ps->list_bottom;
+
+  w->next = below;
+  w->prev = above;
+  if (above)
+    above->next = w;
+  else
+    ps->list = w;
+  if (below)
+    below->prev = w;
+  else
+    ps->list_bottom = w;
+}
+
+void win_stack_remove(session_t *ps, win *w) {
+  if (w->prev)
+    w->prev->next = w->next;
+  else
+    ps->list = w->next;
+  if (w->next)
+    w->next->prev = w->prev;
+  else
+    ps->list_bottom = w->prev;
+  w->next = w->prev = NULL;
+}
+
+/**
+ * Set the bounding shape of a window from the replies to shape queries.
+ *
+ * @param extents reply to a shape extents query, NULL if not available
+ * @param r reply to a bounding rectangles query, NULL if not available
+ */
+static void win_set_bounding_shape(session_t *ps, win *w,
+    xcb_shape_query_extents_reply_t *extents, xcb_shape_get_rectangles_reply_t *r) {
+  w->bounding_shaped = extents && extents->bounding_shaped;
+
+  pixman_region32_clear(&w->bounding_shape);
+  // Start with the window rectangular region
+  win_get_region_local(ps, w, &w->bounding_shape);
+
+  // Only use the bounding region if the window is shaped. If the window
+  // doesn't exist anymore, there won't be a reply.
+  if (w->bounding_shaped && r) {
+    xcb_rectangle_t *xrects = xcb_shape_get_rectangles_rectangles(r);
+    int nrects = xcb_shape_get_rectangles_rectangles_length(r);
+    rect_t *rects = from_x_rects(nrects, xrects);
+
+    region_t br;
+    pixman_region32_init_rects(&br, rects, nrects);
+    free(rects);
+
+    // Add border width because we are using a different origin.
+    // X thinks the top left of the inner window is the origin,
+    // We think the top left of the border is the origin
+    pixman_region32_translate(&br, w->g.border_width, w->g.border_width);
+
+    // Intersect the bounding region we got with the window rectangle, to
+    // make sure the bounding region is not bigger than the window
+    // rectangle
+    pixman_region32_intersect(&w->bounding_shape, &w->bounding_shape, &br);
+    pixman_region32_fini(&br);
+  }
+
+  if (w->bounding_shaped && ps->o.detect_rounded_corners)
+    win_rounded_corners(ps, w);
+
+  // Window shape changed, we should free old wpaint and shadow pict
+  free_paint(ps, &w->paint);
+  shadow_release(ps, &w->shadow_image);
+  //log_trace("free out dated pict");
+
+  win_on_factor_change(ps, w);
+}
+
 // TODO: probably split into win_new (in win.c) and add_win (in compton.c)
 bool add_win(session_t *ps, xcb_window_t id, xcb_window_t prev) {
   static const win win_def = {
       .win_data = NULL,
       .next = NULL,
+      .prev = NULL,
       .prev_trans = NULL,
 
       .id = XCB_NONE,
@@ -753,6 +1079,7 @@ bool add_win(session_t *ps, xcb_window_t id, xcb_window_t prev) {
       .queue_configure = {},
       .reg_ignore = NULL,
       .reg_ignore_valid = false,
+      .stale_rules = 0,
 
       .widthb = 0,
       .heightb = 0,
@@ -775,12 +1102,15 @@ bool add_win(session_t *ps, xcb_window_t id, xcb_window_t prev) {
       .class_instance = NULL,
       .class_general = NULL,
       .role = NULL,
+      .text_fetching = 0,
+      .c2_props = NULL,
       .cache_sblst = NULL,
       .cache_fblst = NULL,
       .cache_fcblst = NULL,
       .cache_ivclst = NULL,
       .cache_bbblst = NULL,
       .cache_oparule = NULL,
+      .cache_dsrule = NULL,
 
       .opacity = 0,
       .opacity_tgt = 0,
@@ -803,7 +1133,7 @@ bool add_win(session_t *ps, xcb_window_t id, xcb_window_t prev) {
       .shadow_dy = 0,
       .shadow_width = 0,
       .shadow_height = 0,
-      .shadow_paint = PAINT_INIT,
+      .shadow_image = NULL,
       .prop_shadow = -1,
 
       .dim = false,
@@ -827,81 +1157,147 @@ bool add_win(session_t *ps, xcb_window_t id, xcb_window_t prev) {
   *new = win_def;
   pixman_region32_init(&new->bounding_shape);
 
-  // Find window insertion point
-  win **p = NULL;
-  if (prev) {
-    for (p = &ps->list; *p; p = &(*p)->next) {
-      if ((*p)->id == prev && !(*p)->destroyed)
-        break;
-    }
-  } else {
-    p = &ps->list;
-  }
-
   // Fill structure
   new->id = id;
 
-  xcb_get_window_attributes_cookie_t acookie = xcb_get_window_attributes(ps->c, id);
-  xcb_get_geometry_cookie_t gcookie = xcb_get_geometry(ps->c, id);
-  xcb_get_window_attributes_reply_t *a = xcb_get_window_attributes_reply(ps->c, acookie, NULL);
-  xcb_get_geometry_reply_t *g = xcb_get_geometry_reply(ps->c, gcookie, NULL);
-  if (!a || a->map_state == XCB_MAP_STATE_UNVIEWABLE) {
-    // Failed to get window attributes probably means the window is gone
-    // already. Unviewable means the window is already reparented
-    // elsewhere.
-    free(a);
-    free(g);
-    free(new);
-    return false;
+  // Send all the requests we need in one go, the replies are collected by
+  // win_finish_add(). Until then the window stays in the pending state.
+  if (ps->shape_exists) {
+    new->pending_shape = xcb_shape_query_extents(ps->c, id);
+    new->pending_shape_rects =
+      xcb_shape_get_rectangles(ps->c, id, XCB_SHAPE_SK_BOUNDING);
   }
+  // We don't know the window class yet. Damage creation fails on InputOnly
+  // windows, so ignore the error, the damage will be dropped in
+  // win_finish_add().
+  new->damage_strategy = ps->o.damage_strategy;
+  new->damage = xcb_generate_id(ps->c);
+  set_ignore_cookie(ps, xcb_damage_create(ps->c, new->damage, id,
+    damage_report_levels[new->damage_strategy]));
+  new->pending_attr = xcb_get_window_attributes(ps->c, id);
+  // This must be the last request, see win_poll_pending()
+  new->pending_geom = xcb_get_geometry(ps->c, id);
+  new->pending = true;
+  ps->npending_wins++;
+
+  // Put the new window directly above prev, on top if prev is not
+  // specified, and at the bottom if prev is not found
+  win *below = NULL;
+  if (prev)
+    below = find_win(ps, prev);
+  else
+    below = ps->list;
+  win_stack_insert(ps, new, below);
+  HASH_ADD(hh, ps->windows, id, sizeof(new->id), new);
 
-  new->a = *a;
-  free(a);
+  return true;
+}
 
-  if (!g) {
-    free(new);
-    return false;
+/**
+ * Drop a window whose adding failed.
+ */
+static void win_drop_pending(session_t *ps, win *w) {
+  if (w->damage)
+    set_ignore_cookie(ps, xcb_damage_destroy(ps->c, w->damage));
+  win_stack_remove(ps, w);
+  win_unindex(ps, w);
+  pixman_region32_fini(&w->bounding_shape);
+  free(w);
+}
+
+/**
+ * Finish adding a window with the replies to the requests sent by add_win().
+ *
+ * @param has_g whether the reply to the geometry request has already been
+ *              collected, otherwise wait for it here
+ * @param g the collected reply to the geometry request, NULL if the request
+ *          failed
+ */
+static void win_finish_add_(session_t *ps, win **_w, bool has_g,
+                            xcb_get_geometry_reply_t *g) {
+  win *w = *_w;
+  assert(w->pending);
+
+  if (!has_g)
+    g = xcb_get_geometry_reply(ps->c, w->pending_geom, NULL);
+  xcb_get_window_attributes_reply_t *a =
+    xcb_get_window_attributes_reply(ps->c, w->pending_attr, NULL);
+  xcb_shape_query_extents_reply_t *extents = NULL;
+  xcb_shape_get_rectangles_reply_t *rects = NULL;
+  if (ps->shape_exists) {
+    extents = xcb_shape_query_extents_reply(ps->c, w->pending_shape, NULL);
+    rects = xcb_shape_get_rectangles_reply(ps->c, w->pending_shape_rects, NULL);
   }
 
-  new->g = *g;
-  free(g);
+  w->pending = false;
+  ps->npending_wins--;
+
+  if (!a || a->map_state == XCB_MAP_STATE_UNVIEWABLE || !g) {
+    // Failed to get window attributes probably means the window is gone
+    // already. Unviewable means the window is already reparented
+    // elsewhere.
+    log_trace("(%#010x): window is gone", w->id);
+    win_drop_pending(ps, w);
+    *_w = NULL;
+    goto out;
+  }
+
+  w->a = *a;
+  w->g = *g;
 
   // Delay window mapping
-  int map_state = new->a.map_state;
+  int map_state = w->a.map_state;
   assert(map_state == XCB_MAP_STATE_VIEWABLE || map_state == XCB_MAP_STATE_UNMAPPED);
-  new->a.map_state = XCB_MAP_STATE_UNMAPPED;
-
-  if (InputOutput == new->a._class) {
-    // Create Damage for window
-    new->damage = xcb_generate_id(ps->c);
-    xcb_generic_error_t *e = xcb_request_check(ps->c,
-      xcb_damage_create_checked(ps->c, new->damage, id, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY));
-    if (e) {
-      free(e);
-      free(new);
-      return false;
-    }
-    new->pictfmt = x_get_pictform_for_visual(ps, new->a.visual);
-  }
+  w->a.map_state = XCB_MAP_STATE_UNMAPPED;
 
-  calc_win_size(ps, new);
+  if (InputOutput == w->a._class) {
+    w->pictfmt = x_get_pictform_for_visual(ps, w->a.visual);
+  } else {
+    set_ignore_cookie(ps, xcb_damage_destroy(ps->c, w->damage));
+    w->damage = XCB_NONE;
+  }
 
-  new->next = *p;
-  *p = new;
-  win_update_bounding_shape(ps, new);
+  calc_win_size(ps, w);
+  win_set_bounding_shape(ps, w, extents, rects);
 
 #ifdef CONFIG_DBUS
   // Send D-Bus signal
   if (ps->o.dbus) {
-    cdbus_ev_win_added(ps, new);
+    cdbus_ev_win_added(ps, w);
   }
 #endif
 
   if (map_state == XCB_MAP_STATE_VIEWABLE) {
-    map_win(ps, id);
+    map_win(ps, w->id);
   }
 
-  return true;
+out:
+  free(a);
+  free(g);
+  free(extents);
+  free(rects);
+}
+
+void win_finish_add(session_t *ps, win **_w) {
+  win_finish_add_(ps, _w, false, NULL);
+}
+
+bool win_poll_pending(session_t *ps) {
+  bool progress = false;
+  for (win *w = ps->list, *next; w && ps->npending_wins; w = next) {
+    next = w->next;
+    if (!w->pending)
+      continue;
+
+    // Replies arrive in request order, so once the reply to the last
+    // request is here, all the others are too.
+    xcb_get_geometry_reply_t *g = NULL;
+    if (xcb_poll_for_reply(ps->c, w->pending_geom.sequence, (void **)&g, NULL)) {
+      win_finish_add_(ps, &w, true, g);
+      progress = true;
+    }
+  }
+  return progress;
 }
 
 /**
@@ -1016,45 +1412,6 @@ xcb_window_t win_get_leader_raw(session_t *ps, win *w, int recursions) {
   return w->cache_leader;
 }
 
-/**
- * Retrieve the <code>WM_CLASS</code> of a window and update its
- * <code>win</code> structure.
- */
-bool win_get_class(session_t *ps, win *w) {
-  char **strlst = NULL;
-  int nstr = 0;
-
-  // Can't do anything if there's no client window
-  if (!w->client_win)
-    return false;
-
-  // Free and reset old strings
-  free(w->class_instance);
-  free(w->class_general);
-  w->class_instance = NULL;
-  w->class_general = NULL;
-
-  // Retrieve the property string list
-  if (!wid_get_text_prop(ps, w->client_win, ps->atom_class, &strlst, &nstr))
-    return false;
-
-  // Copy the strings if successful
-  w->class_instance = strdup(strlst[0]);
-
-  if (nstr > 1)
-    w->class_general = strdup(strlst[1]);
-
-  XFreeStringList(strlst);
-
-  log_trace("(%#010x): client = %#010x, "
-            "instance = \"%s\", general = \"%s\"",
-            w->id, w->client_win, w->class_instance, w->class_general);
-
-  return true;
-}
-
-
-
 /**
  * Handle window focus change.
  */
@@ -1149,58 +1506,21 @@ gen_by_val(win_extents)
  * Mark the window shape as updated
  */
 void win_update_bounding_shape(session_t *ps, win *w) {
-  if (ps->shape_exists)
-    w->bounding_shaped = win_bounding_shaped(ps, w->id);
-
-  pixman_region32_clear(&w->bounding_shape);
-  // Start with the window rectangular region
-  win_get_region_local(ps, w, &w->bounding_shape);
-
-  // Only request for a bounding region if the window is shaped
-  // (while loop is used to avoid goto, not an actual loop)
-  while (w->bounding_shaped) {
-    /*
-     * if window doesn't exist anymore,  this will generate an error
-     * as well as not generate a region.
-     */
+  xcb_shape_query_extents_reply_t *extents = NULL;
+  xcb_shape_get_rectangles_reply_t *r = NULL;
 
-    xcb_shape_get_rectangles_reply_t *r = xcb_shape_get_rectangles_reply(ps->c,
-        xcb_shape_get_rectangles(ps->c, w->id, XCB_SHAPE_SK_BOUNDING), NULL);
-
-    if (!r)
-      break;
-
-    xcb_rectangle_t *xrects = xcb_shape_get_rectangles_rectangles(r);
-    int nrects = xcb_shape_get_rectangles_rectangles_length(r);
-    rect_t *rects = from_x_rects(nrects, xrects);
-    free(r);
-
-    region_t br;
-    pixman_region32_init_rects(&br, rects, nrects);
-    free(rects);
-
-    // Add border width because we are using a different origin.
-    // X thinks the top left of the inner window is the origin,
-    // We think the top left of the border is the origin
-    pixman_region32_translate(&br, w->g.border_width, w->g.border_width);
-
-    // Intersect the bounding region we got with the window rectangle, to
-    // make sure the bounding region is not bigger than the window
-    // rectangle
-    pixman_region32_intersect(&w->bounding_shape, &w->bounding_shape, &br);
-    pixman_region32_fini(&br);
-    break;
+  if (ps->shape_exists) {
+    extents = xcb_shape_query_extents_reply(ps->c,
+        xcb_shape_query_extents(ps->c, w->id), NULL);
+    // Only request for a bounding region if the window is shaped
+    if (extents && extents->bounding_shaped)
+      r = xcb_shape_get_rectangles_reply(ps->c,
+          xcb_shape_get_rectangles(ps->c, w->id, XCB_SHAPE_SK_BOUNDING), NULL);
   }
 
-  if (w->bounding_shaped && ps->o.detect_rounded_corners)
-    win_rounded_corners(ps, w);
-
-  // Window shape changed, we should free old wpaint and shadow pict
-  free_paint(ps, &w->paint);
-  free_paint(ps, &w->shadow_paint);
-  //log_trace("free out dated pict");
-
-  win_on_factor_change(ps, w);
+  win_set_bounding_shape(ps, w, extents, r);
+  free(extents);
+  free(r);
 }
 
 /**
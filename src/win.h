@@ -3,9 +3,11 @@
 // Copyright (c) 2013 Richard Grenville <pyxlcy@gmail.com>
 #pragma once
 #include <stdbool.h>
+#include <time.h>
 #include <xcb/xcb.h>
 #include <xcb/render.h>
 #include <xcb/damage.h>
+#include <xcb/shape.h>
 
 // FIXME shouldn't need this
 #ifdef CONFIG_OPENGL
@@ -17,8 +19,10 @@
 #include "region.h"
 #include "types.h"
 #include "c2.h"
+#include "istr.h"
 #include "render.h"
 #include "utils.h"
+#include "uthash.h"
 
 typedef struct session session_t;
 typedef struct _glx_texture glx_texture_t;
@@ -64,6 +68,40 @@ typedef enum {
   WMODE_SOLID, // The window is opaque including the frame
 } winmode_t;
 
+/// Ways to find out which parts of a window are damaged.
+enum damage_strategy {
+  /// Use the rectangles reported by DamageNotify, one event each.
+  DAMAGE_RECTANGLES,
+  /// Use the bounding box of the damage reported by DamageNotify.
+  DAMAGE_BOUNDING_BOX,
+  /// Fetch the damage region on every DamageNotify, which costs a round
+  /// trip.
+  DAMAGE_NON_EMPTY,
+  NUM_DAMAGE_STRATEGIES,
+};
+
+/// Condition lists window state is derived from.
+enum win_rules {
+  WIN_RULES_SHADOW = 1 << 0,
+  WIN_RULES_FADE = 1 << 1,
+  WIN_RULES_INVERT_COLOR = 1 << 2,
+  WIN_RULES_FOCUS = 1 << 3,
+  WIN_RULES_BLUR_BACKGROUND = 1 << 4,
+  WIN_RULES_OPACITY = 1 << 5,
+  WIN_RULES_PAINT = 1 << 6,
+  WIN_RULES_UNREDIR = 1 << 7,
+  WIN_RULES_DAMAGE = 1 << 8,
+  WIN_RULES_ALL = (1 << 9) - 1,
+};
+
+/// Text properties of client windows compton tracks.
+enum win_text_prop {
+  WIN_TEXT_NAME,
+  WIN_TEXT_CLASS,
+  WIN_TEXT_ROLE,
+  NUM_WIN_TEXT_PROPS,
+};
+
 /**
  * About coordinate systems
  *
@@ -82,8 +120,15 @@ struct win {
   void *win_data;
   /// Pointer to the next lower window in window stack.
   win *next;
+  /// Pointer to the next higher window in window stack.
+  win *prev;
   /// Pointer to the next higher window to paint.
   win *prev_trans;
+  /// Hash handle for <code>session_t::windows</code>, keyed by frame ID.
+  UT_hash_handle hh;
+  /// Hash handle for <code>session_t::windows_by_client</code>, keyed by
+  /// client window ID.
+  UT_hash_handle hh_client;
 
   // Core members
   /// ID of the top-level frame window.
@@ -105,6 +150,9 @@ struct win {
   bool pixmap_damaged;
   /// Damage of the window.
   xcb_damage_damage_t damage;
+  /// How damage of the window is found out, decides the report level of
+  /// <code>damage</code>.
+  enum damage_strategy damage_strategy;
   /// Paint info of the window.
   paint_t paint;
 
@@ -128,6 +176,9 @@ struct win {
   rc_region_t *reg_ignore;
   /// Whether the reg_ignore of all windows beneath this window are valid
   bool reg_ignore_valid;
+  /// Condition lists of this window that need to be re-evaluated, a mask
+  /// of <code>enum win_rules</code>. See win_mark_factor_change().
+  unsigned stale_rules;
   /// Cached width/height of the window including border.
   int widthb, heightb;
   /// Whether the window has been destroyed.
@@ -144,6 +195,15 @@ struct win {
   bool unredir_if_possible_excluded;
   /// Whether this window is in open/close state.
   bool in_openclose;
+  /// Whether the window is still waiting for the replies to the requests
+  /// sent by <code>add_win()</code>. Pending windows are in the window stack,
+  /// but nothing else is known about them yet.
+  bool pending;
+  /// Requests sent by <code>add_win()</code>.
+  xcb_get_window_attributes_cookie_t pending_attr;
+  xcb_get_geometry_cookie_t pending_geom;
+  xcb_shape_query_extents_cookie_t pending_shape;
+  xcb_shape_get_rectangles_cookie_t pending_shape_rects;
 
   // Client window related members
   /// ID of the top-level client window of the window.
@@ -167,19 +227,37 @@ struct win {
 
   // Blacklist related members
   /// Name of the window.
-  char *name;
+  istr_t *name;
   /// Window instance class of the window.
-  char *class_instance;
+  istr_t *class_instance;
   /// Window general class of the window.
-  char *class_general;
+  istr_t *class_general;
   /// <code>WM_WINDOW_ROLE</code> value of the window.
-  char *role;
+  istr_t *role;
+  /// Outstanding requests for the text properties of the client window,
+  /// indexed by <code>enum win_text_prop</code>. See
+  /// <code>win_fetch_text_props()</code>.
+  xcb_get_property_cookie_t text_fetch[NUM_WIN_TEXT_PROPS];
+  /// Request for <code>_NET_WM_NAME</code>, sent right before the one for
+  /// <code>WM_NAME</code> in <code>text_fetch</code>.
+  xcb_get_property_cookie_t text_fetch_name_ewmh;
+  /// Mask of the requests in <code>text_fetch</code> whose replies are yet
+  /// to be handled.
+  unsigned text_fetching;
+#ifndef NDEBUG
+  /// When the requests in <code>text_fetch</code> were sent.
+  struct timespec text_fetch_time[NUM_WIN_TEXT_PROPS];
+#endif
+  /// Raw property values fetched for condition matching, valid until a
+  /// PropertyNotify for them arrives.
+  struct c2_prop *c2_props;
   const c2_lptr_t *cache_sblst;
   const c2_lptr_t *cache_fblst;
   const c2_lptr_t *cache_fcblst;
   const c2_lptr_t *cache_ivclst;
   const c2_lptr_t *cache_bbblst;
   const c2_lptr_t *cache_oparule;
+  const c2_lptr_t *cache_dsrule;
   const c2_lptr_t *cache_pblst;
   const c2_lptr_t *cache_uipblst;
 
@@ -232,8 +310,9 @@ struct win {
   int shadow_width;
   /// Height of shadow. Affected by window size and commandline argument.
   int shadow_height;
-  /// Picture to render shadow. Affected by window size.
-  paint_t shadow_paint;
+  /// Shadow image, shared with other windows of the same size. Affected by
+  /// window size.
+  struct shadow_entry *shadow_image;
   /// The value of _COMPTON_SHADOW attribute of the window. Below 0 for
   /// none.
   long prop_shadow;
@@ -261,8 +340,33 @@ struct win {
 #endif
 };
 
-int win_get_name(session_t *ps, win *w);
-int win_get_role(session_t *ps, win *w);
+/**
+ * Request text properties of the client window of a window, without waiting
+ * for the replies. Outstanding requests for the same properties are
+ * superseded.
+ *
+ * @param props mask of <code>1 << enum win_text_prop</code>
+ */
+void win_fetch_text_props(session_t *ps, win *w, unsigned props);
+/**
+ * Wait for the outstanding text property requests of a window, and apply
+ * their replies.
+ *
+ * @return the window attributes that changed, a mask of
+ *         <code>enum c2_dep</code>
+ */
+unsigned win_finish_text_fetch(session_t *ps, win *w);
+/**
+ * Apply the replies to text property requests that have arrived, without
+ * blocking.
+ *
+ * @return whether any reply was applied
+ */
+bool win_poll_text_props(session_t *ps);
+/**
+ * Drop the outstanding text property requests of a window.
+ */
+void win_cancel_text_fetch(session_t *ps, win *w);
 void win_determine_mode(session_t *ps, win *w);
 /**
  * Set real focused state of a window.
@@ -279,14 +383,52 @@ void win_set_blur_background(session_t *ps, win *w, bool blur_background_new);
 void win_determine_blur_background(session_t *ps, win *w);
 void win_on_wtype_change(session_t *ps, win *w);
 void win_on_factor_change(session_t *ps, win *w);
+void win_update_rules(session_t *ps, win *w, unsigned rules);
+/**
+ * Mark that a window attribute or property changed, deferring the
+ * re-evaluation of the condition lists depending on it to the next
+ * paint_preprocess().
+ *
+ * @param deps mask of <code>enum c2_dep</code>
+ * @param atom the changed property, or XCB_NONE
+ */
+void win_mark_factor_change(session_t *ps, win *w, unsigned deps, xcb_atom_t atom);
 void calc_win_size(session_t *ps, win *w);
 void calc_shadow_geometry(session_t *ps, win *w);
 void win_upd_wintype(session_t *ps, win *w);
 void win_mark_client(session_t *ps, win *w, xcb_window_t client);
 void win_unmark_client(session_t *ps, win *w);
 void win_recheck_client(session_t *ps, win *w);
+/**
+ * Remove a window from the window ID indices, so it can no longer be found by
+ * <code>find_win()</code> or <code>find_toplevel()</code>.
+ */
+void win_unindex(session_t *ps, win *w);
+/**
+ * Wait for the replies to the requests sent when a pending window was added,
+ * and finish adding it.
+ *
+ * <code>*_w</code> is set to NULL if the window turned out to be gone.
+ */
+void win_finish_add(session_t *ps, win **_w);
+/**
+ * Finish adding all pending windows whose replies have arrived.
+ *
+ * @return whether any window was finished
+ */
+bool win_poll_pending(session_t *ps);
+/**
+ * Insert a window into the window stack, directly above <code>below</code>.
+ *
+ * @param below the window to stack on top of, NULL to put the window at
+ *              the bottom
+ */
+void win_stack_insert(session_t *ps, win *w, win *below);
+/**
+ * Remove a window from the window stack.
+ */
+void win_stack_remove(session_t *ps, win *w);
 xcb_window_t win_get_leader_raw(session_t *ps, win *w, int recursions);
-bool win_get_class(session_t *ps, win *w);
 void win_calc_opacity(session_t *ps, win *w);
 void win_calc_dim(session_t *ps, win *w);
 /**
@@ -334,6 +476,14 @@ region_t win_get_region_noframe_local_by_val(win *w);
  */
 void
 win_update_frame_extents(session_t *ps, win *w, xcb_window_t client);
+/**
+ * Start managing a window.
+ *
+ * The window is put into the window stack right away, in the pending state.
+ * The requests for its attributes are sent without waiting for the replies,
+ * it is finished later by <code>win_poll_pending()</code> or
+ * <code>win_finish_add()</code>.
+ */
 bool add_win(session_t *ps, xcb_window_t id, xcb_window_t prev);
 
 /**
@@ -2,6 +2,7 @@
 // Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <X11/Xutil.h>
 #include <xcb/xcb.h>
@@ -20,6 +21,14 @@
 #include "common.h"
 #include "x.h"
 #include "log.h"
+#include "uthash.h"
+
+/// An entry of the atom name cache.
+struct x_atom_name {
+  xcb_atom_t atom;
+  char *name;
+  UT_hash_handle hh;
+};
 
 /**
  * Get a specific attribute of a window.
@@ -111,6 +120,31 @@ bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop,
   return true;
 }
 
+bool x_text_prop_to_strlst(session_t *ps, xcb_get_property_reply_t *r,
+    char ***pstrlst, int *pnstr) {
+  if (!r || r->format != 8 || !xcb_get_property_value_length(r))
+    return false;
+
+  XTextProperty text_prop = {
+    .value = xcb_get_property_value(r),
+    .encoding = r->type,
+    .format = r->format,
+    .nitems = r->value_len,
+  };
+
+  *pstrlst = NULL;
+  if (Success !=
+      XmbTextPropertyToTextList(ps->dpy, &text_prop, pstrlst, pnstr)
+      || !*pnstr) {
+    *pnstr = 0;
+    if (*pstrlst)
+      XFreeStringList(*pstrlst);
+    return false;
+  }
+
+  return true;
+}
+
 static inline void x_get_server_pictfmts(session_t *ps) {
   if (ps->pictfmts)
     return;
@@ -406,6 +440,22 @@ x_create_pixmap(session_t *ps, uint8_t depth, xcb_drawable_t drawable, uint16_t
   return XCB_NONE;
 }
 
+void
+x_put_image(session_t *ps, xcb_drawable_t drawable, xcb_gcontext_t gc,
+            const xcb_image_t *image, int dst_x, int dst_y) {
+  // xcb shuts the connection down on requests that are too long
+  const size_t max_len = (size_t)xcb_get_maximum_request_length(ps->c) * 4
+    - sizeof(xcb_put_image_request_t);
+  const int rows = max_i(1, (int)min_l((long)(max_len / image->stride), image->height));
+  for (int y = 0; y < image->height; y += rows) {
+    const int nrows = min_i(rows, image->height - y);
+    xcb_put_image(ps->c, image->format, drawable, gc, image->width,
+      (uint16_t)nrows, (int16_t)dst_x, (int16_t)(dst_y + y), 0,
+      image->depth, (uint32_t)nrows * image->stride,
+      image->data + (size_t)y * image->stride);
+  }
+}
+
 /**
  * Validate a pixmap.
  *
@@ -427,22 +477,42 @@ x_validate_pixmap(session_t *ps, xcb_pixmap_t pixmap) {
   free(r);
   return ret;
 }
-/// Names of root window properties that could point to a pixmap of
-/// background.
-static const char *background_props_str[] = {
-  "_XROOTPMAP_ID",
-  "_XSETROOT_ID",
-  0,
-};
+const char *x_get_atom_name(session_t *ps, xcb_atom_t atom) {
+  struct x_atom_name *entry = NULL;
+  HASH_FIND(hh, ps->atom_names, &atom, sizeof(atom), entry);
+  if (entry)
+    return entry->name;
+
+  xcb_get_atom_name_reply_t *reply =
+    xcb_get_atom_name_reply(ps->c, xcb_get_atom_name(ps->c, atom), NULL);
+  if (!reply)
+    return NULL;
+
+  entry = cmalloc(struct x_atom_name);
+  entry->atom = atom;
+  entry->name = strndup(xcb_get_atom_name_name(reply),
+                        xcb_get_atom_name_name_length(reply));
+  free(reply);
+  HASH_ADD(hh, ps->atom_names, atom, sizeof(entry->atom), entry);
+  return entry->name;
+}
+
+void x_free_atom_names(session_t *ps) {
+  struct x_atom_name *entry, *tmp;
+  HASH_ITER(hh, ps->atom_names, entry, tmp) {
+    HASH_DEL(ps->atom_names, entry);
+    free(entry->name);
+    free(entry);
+  }
+}
 
 xcb_pixmap_t x_get_root_back_pixmap(session_t *ps) {
   xcb_pixmap_t pixmap = XCB_NONE;
 
   // Get the values of background attributes
-  for (int p = 0; background_props_str[p]; p++) {
-    xcb_atom_t prop_atom = get_atom(ps, background_props_str[p]);
+  for (int p = 0; p < NUM_BACKGROUND_PROPS; p++) {
     winprop_t prop =
-      wid_get_prop(ps, ps->root, prop_atom, 1, XCB_ATOM_PIXMAP, 32);
+      wid_get_prop(ps, ps->root, ps->atoms_background[p], 1, XCB_ATOM_PIXMAP, 32);
     if (prop.nitems) {
       pixmap = *prop.p32;
       free_winprop(&prop);
@@ -455,9 +525,8 @@ xcb_pixmap_t x_get_root_back_pixmap(session_t *ps) {
 }
 
 bool x_atom_is_background_prop(session_t *ps, xcb_atom_t atom) {
-  for (int p = 0; background_props_str[p]; p++) {
-    xcb_atom_t prop_atom = get_atom(ps, background_props_str[p]);
-    if (prop_atom == atom)
+  for (int p = 0; p < NUM_BACKGROUND_PROPS; p++) {
+    if (ps->atoms_background[p] == atom)
       return true;
   }
   return false;
@@ -9,6 +9,7 @@
 #include <xcb/sync.h>
 #include <xcb/xfixes.h>
 #include <xcb/xcb_renderutil.h>
+#include <xcb/xcb_image.h>
 
 #include "compiler.h"
 #include "region.h"
@@ -96,6 +97,20 @@ wid_get_prop_window(session_t *ps, xcb_window_t wid, xcb_atom_t aprop);
 bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop,
     char ***pstrlst, int *pnstr);
 
+/// Length of text properties to request, in 32-bit units. The same as what
+/// XGetTextProperty() uses.
+#define X_TEXT_PROP_MAX_LEN 1000000
+
+/**
+ * Convert the reply to a GetProperty request for a text property into a list
+ * of strings in the current locale, like wid_get_text_prop() does. Doesn't
+ * wait for the X server.
+ *
+ * The list must be freed with XFreeStringList().
+ */
+bool x_text_prop_to_strlst(session_t *ps, xcb_get_property_reply_t *r,
+    char ***pstrlst, int *pnstr);
+
 xcb_render_pictforminfo_t *x_get_pictform_for_visual(session_t *, xcb_visualid_t);
 
 xcb_render_picture_t x_create_picture_with_pictfmt_and_pixmap(
@@ -151,6 +166,14 @@ x_create_pixmap(session_t *ps, uint8_t depth, xcb_drawable_t drawable, uint16_t
 bool
 x_validate_pixmap(session_t *ps, xcb_pixmap_t pxmap);
 
+/**
+ * Upload an image to a drawable, split into strips of rows so no request
+ * goes over the maximum request length of the connection.
+ */
+void
+x_put_image(session_t *ps, xcb_drawable_t drawable, xcb_gcontext_t gc,
+            const xcb_image_t *image, int dst_x, int dst_y);
+
 /**
  * Free a <code>winprop_t</code>.
  *
@@ -165,6 +188,20 @@ free_winprop(winprop_t *pprop) {
   pprop->r = NULL;
   pprop->nitems = 0;
 }
+/**
+ * Get the name of an atom.
+ *
+ * An atom never changes its name during the lifetime of the X server, so
+ * names are cached in the session and only the first lookup of an atom costs
+ * a round trip.
+ *
+ * @return the name, owned by the cache, or NULL if the atom is invalid
+ */
+const char *x_get_atom_name(session_t *ps, xcb_atom_t atom);
+
+/// Free the atom name cache.
+void x_free_atom_names(session_t *ps);
+
 /// Get the back pixmap of the root window
 xcb_pixmap_t x_get_root_back_pixmap(session_t *ps);
 